@@ -28,7 +28,41 @@ enum TrapCalls
   TrapWrite = 0x74697257,
   TrapJail = 0x6c69614a,
   TrapUnjail = 0x6c6a6e55,
-  TrapExit = 0x74697845
+  TrapExit = 0x74697845,
+  TrapBarrier = 0x72726142,
+  TrapBroadcast = 0x74736342,
+  TrapReduce = 0x63756452,
+  TrapAllreduce = 0x726c6c41,
+  TrapHeap = 0x70616548,
+  TrapDiscard = 0x63736944
+};
+
+/* element types of the collective reduction */
+enum ReduceType
+{
+  ReduceInt32,
+  ReduceInt64,
+  ReduceFloat,
+  ReduceDouble,
+  ReduceTypesCount
+};
+
+/* operators of the collective reduction */
+enum ReduceOperator
+{
+  ReduceSum,
+  ReduceMin,
+  ReduceMax,
+  ReduceOperatorsCount
+};
+
+/* the input split given by the work queue channel read */
+struct ZVMSplit
+{
+  int32_t channel; /* the input channel descriptor */
+  int32_t reserved; /* zero */
+  int64_t offset; /* the split start in the input channel */
+  int64_t length; /* the split size in bytes */
 };
 
 /* channel types */
@@ -90,9 +124,30 @@ struct UserManifest
  *   "buffer" should be 64kb aligned and point to heap
  * zvm_exit
  *   terminate program with "code"
+ * zvm_heap
+ *   grow the heap to "size" bytes (64kb rounded) up to the "Memory" limit.
+ *   the new size is in MANIFEST->heap_size. smaller "size" is ignored
+ * zvm_discard
+ *   release "size" bytes of memory from "buffer", the next read gets zeroes.
+ *   "buffer" and "size" should be 64kb aligned and point to heap
+ *
+ * collective functions. all nodes of the manifest "Group" must call
+ * them in the same order with the same arguments. "root" is the node
+ * position in the group list, "count" is the number of "type" elements
+ *
+ * zvm_barrier
+ *   wait until all nodes of the group called it
+ * zvm_bcast
+ *   copy "size" bytes of "root" node "buffer" to "buffer" of all nodes
+ * zvm_reduce
+ *   combine "buffer" arrays of all nodes element by element with "op"
+ *   (enum ReduceOperator) and put the result to "buffer" of "root" node
+ * zvm_allreduce
+ *   same as zvm_reduce but the result goes to "buffer" of all nodes
  *
  * all trap functions return -errno code if error encountered, otherwise
- * result equal to processed bytes or 0 (for (un)jail). exit does not return
+ * result equal to processed bytes or 0 (for (un)jail, heap, discard). exit does
+ * not return
  */
 #define zvm_pread(desc, buffer, size, offset) \
   TRAP((uint64_t[]){TrapRead, 0, desc, (uintptr_t)buffer, size, offset})
@@ -103,5 +158,15 @@ struct UserManifest
 #define zvm_unjail(buffer, size) \
   TRAP((uint64_t[]){TrapUnjail, 0, (uintptr_t)buffer, size})
 #define zvm_exit(code) TRAP((uint64_t[]){TrapExit, 0, code})
+#define zvm_heap(size) TRAP((uint64_t[]){TrapHeap, 0, size})
+#define zvm_discard(buffer, size) \
+  TRAP((uint64_t[]){TrapDiscard, 0, (uintptr_t)buffer, size})
+#define zvm_barrier() TRAP((uint64_t[]){TrapBarrier, 0})
+#define zvm_bcast(buffer, size, root) \
+  TRAP((uint64_t[]){TrapBroadcast, 0, (uintptr_t)buffer, size, root})
+#define zvm_reduce(buffer, count, type, op, root) \
+  TRAP((uint64_t[]){TrapReduce, 0, (uintptr_t)buffer, count, type, op, root})
+#define zvm_allreduce(buffer, count, type, op) \
+  TRAP((uint64_t[]){TrapAllreduce, 0, (uintptr_t)buffer, count, type, op})
 
 #endif /* ZVM_API_H__ */
@@ -0,0 +1,331 @@
+/*
+ * collective operations over the group of nodes. the group is the
+ * binary tree by the node position (rank) in the manifest "Group" list:
+ * the parent of rank r is (r - 1) / 2. each node has duplex native
+ * channels to its parent and children only, so the group of n nodes
+ * takes n - 1 connections and log2(n) hops
+ *
+ * reduction goes up to the group head (rank 0). each node combines
+ * own data with the left child data and then with the right child
+ * data, so the order (and floating point result) never depends on
+ * the timing. broadcast from the other than the group head root goes
+ * up the tree path first and then down the tree
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <arpa/inet.h>
+#include "src/main/manifest_parser.h"
+#include "src/main/manifest_setup.h"
+#include "src/main/nacl_exit.h"
+#include "src/channels/prefetch.h"
+#include "src/channels/collective.h"
+
+#define PARENT 0 /* links[PARENT] is the parent, links[1..2] are children */
+
+static struct ChannelDesc links[GROUP_LINKS];
+static uint32_t rank = 0; /* own position in the group */
+static uint32_t nodes = 0; /* group size. 0 - no group */
+
+/* combine "acc" with "in" element by element. simple loops are vectorized */
+#define DEFINE_COMBINE(name, type) \
+static void name(type *acc, const type *in, int32_t count, \
+    enum ReduceOperator op) \
+{ \
+  int32_t i; \
+  switch(op) \
+  { \
+    case ReduceSum: \
+      for(i = 0; i < count; ++i) acc[i] += in[i]; \
+      break; \
+    case ReduceMin: \
+      for(i = 0; i < count; ++i) acc[i] = in[i] < acc[i] ? in[i] : acc[i]; \
+      break; \
+    case ReduceMax: \
+      for(i = 0; i < count; ++i) acc[i] = in[i] > acc[i] ? in[i] : acc[i]; \
+      break; \
+    default: \
+      break; \
+  } \
+}
+
+DEFINE_COMBINE(CombineInt32, int32_t)
+DEFINE_COMBINE(CombineInt64, int64_t)
+DEFINE_COMBINE(CombineFloat, float)
+DEFINE_COMBINE(CombineDouble, double)
+#undef DEFINE_COMBINE
+
+static void Combine(char *acc, const char *in, int32_t count,
+    enum ReduceType type, enum ReduceOperator op)
+{
+  switch(type)
+  {
+    case ReduceInt32:
+      CombineInt32((int32_t*)acc, (const int32_t*)in, count, op);
+      break;
+    case ReduceInt64:
+      CombineInt64((int64_t*)acc, (const int64_t*)in, count, op);
+      break;
+    case ReduceFloat:
+      CombineFloat((float*)acc, (const float*)in, count, op);
+      break;
+    case ReduceDouble:
+      CombineDouble((double*)acc, (const double*)in, count, op);
+      break;
+    default: /* design error */
+      ZLOGFAIL(1, EFAULT, "invalid reduction type");
+      break;
+  }
+}
+
+int CollectiveTypeSize(enum ReduceType type)
+{
+  switch(type)
+  {
+    case ReduceInt32: return sizeof(int32_t);
+    case ReduceInt64: return sizeof(int64_t);
+    case ReduceFloat: return sizeof(float);
+    case ReduceDouble: return sizeof(double);
+    default: return 0;
+  }
+}
+
+/* return not 0 if the node "r" is the node "root" or its ancestor */
+static int OnPath(uint32_t r, uint32_t root)
+{
+  while(root > r) root = (root - 1) / 2;
+  return root == r;
+}
+
+/* return the link to the child on the path to "root" or NULL */
+static struct ChannelDesc *PathChild(uint32_t root)
+{
+  int i;
+
+  for(i = PARENT + 1; i < GROUP_LINKS; ++i)
+    if(links[i].name != NULL && OnPath(2 * rank + i, root)) return &links[i];
+  return NULL;
+}
+
+/* send the message to the link. return 0 if successful */
+static int Send(struct ChannelDesc *link,
+    uint32_t call, const char *buffer, int32_t size)
+{
+  struct CollectiveHeader header;
+
+  header.call = htonl(call);
+  header.size = htonl(size);
+  if(SendMessage(link, (char*)&header, sizeof header) != sizeof header)
+    return -1;
+  if(size > 0 && SendMessage(link, buffer, size) != size) return -1;
+  return 0;
+}
+
+/* receive the message of the given call and size. return 0 if successful */
+static int Receive(struct ChannelDesc *link,
+    uint32_t call, char *buffer, int32_t size)
+{
+  struct CollectiveHeader header;
+
+  if(FetchMessage(link, (char*)&header, sizeof header) != sizeof header)
+    return -1;
+  if(ntohl(header.call) != call || ntohl(header.size) != (uint32_t)size)
+  {
+    ZLOG(LOG_ERROR, "%s called other collective operation", link->alias);
+    return -1;
+  }
+  if(size > 0 && FetchMessage(link, buffer, size) != size) return -1;
+  return 0;
+}
+
+/*
+ * combine "acc" with the partial results of the children (left one
+ * first) and send it to the parent. "tmp" takes the children data
+ */
+static int ReduceUp(char *acc, char *tmp, int32_t count,
+    enum ReduceType type, enum ReduceOperator op, uint32_t call)
+{
+  int32_t size = count * CollectiveTypeSize(type);
+  int i;
+
+  for(i = PARENT + 1; i < GROUP_LINKS; ++i)
+  {
+    if(links[i].name == NULL) continue;
+    if(Receive(&links[i], call, tmp, size) != 0) return -1;
+    Combine(acc, tmp, count, type, op);
+  }
+
+  return rank == 0 ? 0 : Send(&links[PARENT], call, acc, size);
+}
+
+/*
+ * deliver "buffer" of the node "root" to all nodes: up the path from
+ * "root" to the group head, then down the tree skipping the path
+ */
+static int BroadcastFrom(char *buffer, int32_t size, uint32_t root, uint32_t call)
+{
+  struct ChannelDesc *child = PathChild(root);
+  int i;
+
+  if(child != NULL && Receive(child, call, buffer, size) != 0) return -1;
+  if(rank != 0 && OnPath(rank, root)
+      && Send(&links[PARENT], call, buffer, size) != 0) return -1;
+
+  if(!OnPath(rank, root)
+      && Receive(&links[PARENT], call, buffer, size) != 0) return -1;
+  for(i = PARENT + 1; i < GROUP_LINKS; ++i)
+  {
+    if(links[i].name == NULL || OnPath(2 * rank + i, root)) continue;
+    if(Send(&links[i], call, buffer, size) != 0) return -1;
+  }
+  return 0;
+}
+
+int32_t CollectiveBarrier()
+{
+  if(nodes == 0) return -ENOTCONN;
+
+  if(ReduceUp(NULL, NULL, 0, ReduceInt32, ReduceSum, TrapBarrier) != 0
+      || BroadcastFrom(NULL, 0, 0, TrapBarrier) != 0) return -EIO;
+  return 0;
+}
+
+int32_t CollectiveBroadcast(char *buffer, int32_t size, uint32_t root)
+{
+  if(nodes == 0) return -ENOTCONN;
+  if(size < 0 || root >= nodes) return -EINVAL;
+
+  return BroadcastFrom(buffer, size, root, TrapBroadcast) == 0 ? 0 : -EIO;
+}
+
+int32_t CollectiveReduce(char *buffer, int32_t count,
+    enum ReduceType type, enum ReduceOperator op, uint32_t root)
+{
+  struct ChannelDesc *child;
+  int64_t size = (int64_t)count * CollectiveTypeSize(type);
+  char *acc;
+  int result;
+
+  if(nodes == 0) return -ENOTCONN;
+  if(size <= 0 || size > INT32_MAX || op < 0 || op >= ReduceOperatorsCount
+      || root >= nodes) return -EINVAL;
+
+  /* the buffers of the other than "root" nodes stay untouched */
+  acc = g_malloc(2 * size);
+  memcpy(acc, buffer, size);
+  result = ReduceUp(acc, acc + size, count, type, op, TrapReduce);
+
+  /* the result goes down the path from the group head to "root" */
+  if(result == 0 && rank != 0 && OnPath(rank, root))
+    result = Receive(&links[PARENT], TrapReduce, acc, size);
+  child = PathChild(root);
+  if(result == 0 && child != NULL)
+    result = Send(child, TrapReduce, acc, size);
+
+  if(result == 0 && rank == root) memcpy(buffer, acc, size);
+  g_free(acc);
+  return result == 0 ? 0 : -EIO;
+}
+
+int32_t CollectiveAllreduce(char *buffer, int32_t count,
+    enum ReduceType type, enum ReduceOperator op)
+{
+  int64_t size = (int64_t)count * CollectiveTypeSize(type);
+  char *tmp;
+  int result;
+
+  if(nodes == 0) return -ENOTCONN;
+  if(size <= 0 || size > INT32_MAX || op < 0 || op >= ReduceOperatorsCount)
+    return -EINVAL;
+
+  /* all buffers get the result, so they accumulate the partial results */
+  tmp = g_malloc(size);
+  result = ReduceUp(buffer, tmp, count, type, op, TrapAllreduce);
+  if(result == 0) result = BroadcastFrom(buffer, size, 0, TrapAllreduce);
+  g_free(tmp);
+  return result == 0 ? 0 : -EIO;
+}
+
+/* construct the duplex channel to the node "id" */
+static void LinkCtor(struct ChannelDesc *link, const char *id)
+{
+  int i;
+
+  ZLOGFAIL(ATOI(id) <= 0, EFAULT, "Group has invalid node id %s", id);
+
+  memset(link, 0, sizeof *link);
+  link->name = g_strdup_printf("tcp:%s:", id);
+  link->alias = g_strdup_printf("group:%s", id);
+  link->source = ChannelTCP;
+  link->type = SGetSPut;
+  link->duplex = 1;
+  for(i = 0; i < IOLimitsCount; ++i)
+    link->limits[i] = INT64_MAX;
+
+  ZLOGFAIL(PrefetchChannelCtor(link) != 0, EFAULT,
+      "cannot allocate %s", link->alias);
+}
+
+void CollectiveCtor(struct NaClApp *nap)
+{
+  char *tokens[GROUP_MAX_NODES + 1];
+  int count;
+  int i;
+
+  assert(nap != NULL);
+  assert(nap->system_manifest != NULL);
+
+  count = ParseValue(GetValueByKey(MFT_GROUP), ",", tokens, GROUP_MAX_NODES + 1);
+  if(count == 0) return;
+  ZLOGFAIL(count > GROUP_MAX_NODES, EFAULT, "Group has too many nodes");
+
+  /* find own position */
+  for(rank = 0; rank < count; ++rank)
+    if(ATOI(tokens[rank]) == nap->system_manifest->node) break;
+  ZLOGFAIL(rank == count, EFAULT, "Group does not contain node %d",
+      nap->system_manifest->node);
+  nodes = count;
+
+  /* connect the parent and the children */
+  if(rank > 0)
+    LinkCtor(&links[PARENT], tokens[(rank - 1) / 2]);
+  for(i = PARENT + 1; i < GROUP_LINKS; ++i)
+    if(2 * rank + i < nodes)
+      LinkCtor(&links[i], tokens[2 * rank + i]);
+
+  ZLOGS(LOG_DEBUG, "node %u of %u in the group", rank, nodes);
+}
+
+void CollectiveDtor()
+{
+  int i;
+
+  for(i = 0; i < GROUP_LINKS; ++i)
+  {
+    struct ChannelDesc *link = &links[i];
+    if(link->name == NULL) continue;
+
+    /* same as for the other network channels (see ChannelDtor()) */
+    if(GetExitCode() == 0)
+      PrefetchChannelDtor(link);
+
+    g_free((char*)link->name);
+    g_free((char*)link->alias);
+    link->name = NULL;
+    link->alias = NULL;
+  }
+  nodes = 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * collective operations over the group of nodes (barrier, broadcast,
+ * reduce, allreduce). the nodes are the binary tree by the position
+ * in the manifest "Group" list, tree edges are duplex native channels
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COLLECTIVE_H_
+#define COLLECTIVE_H_
+
+#include "src/channels/mount_channel.h"
+
+#define GROUP_MAX_NODES 0x1000
+#define GROUP_LINKS 3 /* parent and 2 children */
+
+/*
+ * the message header. each collective message starts with it (both
+ * fields in the network order) so the nodes calling the different
+ * operations or sizes are detected instead of mixing the data
+ */
+struct CollectiveHeader
+{
+  uint32_t call; /* enum TrapCalls */
+  uint32_t size; /* payload size */
+};
+
+/*
+ * construct the group from the manifest "Group" key (if specified).
+ * the tree edges are registered as the network channels, so should
+ * be called before KickPrefetchChannels()
+ */
+void CollectiveCtor(struct NaClApp *nap);
+
+/* close the group channels */
+void CollectiveDtor();
+
+/*
+ * collective operations. "buffer" is the system address. return 0
+ * if successful, otherwise -errno. see api/zvm.h for details
+ */
+int32_t CollectiveBarrier();
+int32_t CollectiveBroadcast(char *buffer, int32_t size, uint32_t root);
+int32_t CollectiveReduce(char *buffer, int32_t count,
+    enum ReduceType type, enum ReduceOperator op, uint32_t root);
+int32_t CollectiveAllreduce(char *buffer, int32_t count,
+    enum ReduceType type, enum ReduceOperator op);
+
+/* return the element size of the given reduction type or 0 if invalid */
+int CollectiveTypeSize(enum ReduceType type);
+
+#endif /* COLLECTIVE_H_ */
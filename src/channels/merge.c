@@ -0,0 +1,435 @@
+/*
+ * merge channel. each input has the buffer filled with the big reads,
+ * the inputs with the complete record at the buffer head are kept in
+ * the binary heap ordered by the record key (the equal keys are taken
+ * in the inputs order, so the result does not depend on the timing).
+ * the user gets the heap top record, then the input takes the next
+ * record and goes down the heap
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include "src/main/manifest_parser.h"
+#include "src/main/manifest_setup.h"
+#include "src/channels/merge.h"
+#include "src/channels/record.h"
+
+struct Input
+{
+  struct ChannelDesc *channel;
+  char *buffer;
+  int32_t capacity;
+  int32_t pos; /* the current record start */
+  int32_t end; /* the buffered data end */
+  int32_t size; /* the current record size. 0 - input is over */
+};
+
+struct Merge
+{
+  int32_t record; /* fixed record size. 0 - records have the length prefix */
+  int32_t offset; /* key offset in the record (after the prefix) */
+  int32_t size; /* key size */
+  enum MergeKeyType type;
+  struct Input *inputs;
+  int count; /* inputs number */
+  int *heap; /* inputs indices. the top record is being read by the user */
+  int heap_size;
+  int32_t copied; /* part of the top record given to the user */
+  int started;
+  int failed; /* the input failed after the data was given. reported next call */
+};
+
+/*
+ * read the input channel as the user would do it. return 0 if the input
+ * is over (eof or the limits exhausted) or -1 if failed
+ */
+static int32_t Fetch(struct ChannelDesc *channel, char *buf, int32_t count)
+{
+  int32_t result;
+
+  /* the input limits work as usual, the exhausted input is over */
+  if(channel->eof || channel->counters[GetsLimit] >= channel->limits[GetsLimit])
+    return 0;
+  count = MIN(count, channel->limits[GetSizeLimit] - channel->counters[GetSizeLimit]);
+  if(count <= 0) return 0;
+
+  result = ChannelRead(channel, buf, count, channel->getpos);
+  if(result < 0) return -1;
+
+  /* the input counters and the tag are updated, the digest is checked */
+  ++channel->counters[GetsLimit];
+  if(result > 0)
+  {
+    channel->counters[GetSizeLimit] += result;
+    channel->getpos += result;
+    if(channel->tag != NULL) TagUpdate(channel->tag, buf, result);
+  }
+  if(result == 0) channel->eof = 1;
+  return result;
+}
+
+/*
+ * return the size of the record starting at "buf" or -1 if the
+ * length prefix is not complete yet. invalid size returns 0
+ */
+static int64_t RecordSize(const struct Merge *m, const char *buf, int32_t count)
+{
+  return m->record > 0 ? m->record : PrefixedRecordSize(buf, count);
+}
+
+/* move the input to the next complete record. return -1 if failed */
+static int Next(struct Merge *m, struct Input *in)
+{
+  in->pos += in->size;
+  in->size = 0;
+
+  for(;;)
+  {
+    int32_t avail = in->end - in->pos;
+    int64_t need = RecordSize(m, in->buffer + in->pos, avail);
+    int32_t result;
+
+    if(need == 0)
+    {
+      ZLOG(LOG_ERROR, "%s has the record of invalid size", in->channel->alias);
+      return -1;
+    }
+    if(need > 0 && need <= avail)
+    {
+      in->size = need;
+      return 0;
+    }
+
+    /* move the incomplete record to the buffer start and read more */
+    memmove(in->buffer, in->buffer + in->pos, avail);
+    in->pos = 0;
+    in->end = avail;
+    if(need > in->capacity)
+    {
+      in->capacity = need;
+      in->buffer = g_realloc(in->buffer, in->capacity);
+    }
+
+    result = Fetch(in->channel, in->buffer + in->end, in->capacity - in->end);
+    if(result < 0) return -1;
+
+    /* the input is over (eof or limits), the incomplete record is dropped */
+    if(result == 0)
+    {
+      ZLOGIF(avail > 0, "%s has incomplete last record", in->channel->alias);
+      return 0;
+    }
+    in->end += result;
+  }
+}
+
+/* return the key of the current input record and its available size */
+static const char *Key(const struct Merge *m, const struct Input *in, int32_t *size)
+{
+  const char *payload = in->buffer + in->pos;
+  int32_t length = in->size;
+
+  if(m->record == 0)
+  {
+    payload += RECORD_PREFIX_SIZE;
+    length -= RECORD_PREFIX_SIZE;
+  }
+  *size = MAX(0, MIN(length - m->offset, m->size));
+  return payload + m->offset;
+}
+
+/* return the little endian integer of "size" bytes */
+static int64_t Integer(const char *key, int32_t size, int sign)
+{
+  uint64_t value = 0;
+  int i;
+
+  for(i = size - 1; i >= 0; --i)
+    value = value << 8 | (uint8_t)key[i];
+
+  /* extend the sign of the short integer */
+  if(sign && size < 8 && (value >> (8 * size - 1)) & 1)
+    value |= ~0LLU << (8 * size);
+  return value;
+}
+
+/* return the number less than, equal or greater than 0 like memcmp */
+static int CompareKeys(const struct Merge *m, const char *a, int32_t asize,
+    const char *b, int32_t bsize)
+{
+  int result;
+
+  /* the cut (by the record end) key goes before the whole one */
+  if(m->type == MergeKeyBytes || asize < m->size || bsize < m->size)
+  {
+    result = memcmp(a, b, MIN(asize, bsize));
+    return result != 0 ? result : asize - bsize;
+  }
+
+  switch(m->type)
+  {
+    case MergeKeyInt:
+    {
+      int64_t x = Integer(a, m->size, 1);
+      int64_t y = Integer(b, m->size, 1);
+      return (x > y) - (x < y);
+    }
+    case MergeKeyUint:
+    {
+      uint64_t x = Integer(a, m->size, 0);
+      uint64_t y = Integer(b, m->size, 0);
+      return (x > y) - (x < y);
+    }
+    case MergeKeyFloat:
+    {
+      double x, y;
+      if(m->size == sizeof(float))
+      {
+        float fx, fy;
+        memcpy(&fx, a, sizeof fx);
+        memcpy(&fy, b, sizeof fy);
+        x = fx;
+        y = fy;
+      }
+      else
+      {
+        memcpy(&x, a, sizeof x);
+        memcpy(&y, b, sizeof y);
+      }
+
+      /* NaN goes after all numbers, otherwise the order is not transitive */
+      if(isnan(x) || isnan(y)) return !!isnan(x) - !!isnan(y);
+      return (x > y) - (x < y);
+    }
+    default: /* design error */
+      ZLOGFAIL(1, EFAULT, "invalid merge key type");
+      return 0;
+  }
+}
+
+/* return not 0 if the input "a" record goes before the input "b" one */
+static int Less(const struct Merge *m, int a, int b)
+{
+  int32_t asize, bsize;
+  const char *akey = Key(m, &m->inputs[a], &asize);
+  const char *bkey = Key(m, &m->inputs[b], &bsize);
+  int result = CompareKeys(m, akey, asize, bkey, bsize);
+
+  return result != 0 ? result < 0 : a < b;
+}
+
+/* restore the heap order moving the element "i" down */
+static void SiftDown(struct Merge *m, int i)
+{
+  for(;;)
+  {
+    int smallest = i;
+    int left = 2 * i + 1;
+    int right = left + 1;
+    int tmp;
+
+    if(left < m->heap_size && Less(m, m->heap[left], m->heap[smallest]))
+      smallest = left;
+    if(right < m->heap_size && Less(m, m->heap[right], m->heap[smallest]))
+      smallest = right;
+    if(smallest == i) return;
+
+    tmp = m->heap[i];
+    m->heap[i] = m->heap[smallest];
+    m->heap[smallest] = tmp;
+    i = smallest;
+  }
+}
+
+/* take the 1st records of all inputs and build the heap */
+static int Start(struct Merge *m)
+{
+  int i;
+
+  for(i = 0; i < m->count; ++i)
+  {
+    if(Next(m, &m->inputs[i]) != 0) return -1;
+    if(m->inputs[i].size > 0) m->heap[m->heap_size++] = i;
+  }
+  for(i = m->heap_size / 2 - 1; i >= 0; --i)
+    SiftDown(m, i);
+
+  m->started = 1;
+  return 0;
+}
+
+int32_t MergeFetch(struct ChannelDesc *channel, char *buf, int32_t count)
+{
+  struct Merge *m;
+  int32_t done = 0;
+
+  assert(channel != NULL);
+  assert(channel->socket != NULL);
+  assert(buf != NULL);
+
+  m = channel->socket;
+  if(m->failed) return -1;
+  if(!m->started && Start(m) != 0) return -1;
+
+  while(done < count && m->heap_size > 0)
+  {
+    struct Input *in = &m->inputs[m->heap[0]];
+    int32_t take = MIN(count - done, in->size - m->copied);
+
+    memcpy(buf + done, in->buffer + in->pos + m->copied, take);
+    done += take;
+    m->copied += take;
+    if(m->copied < in->size) break;
+
+    /* the record is taken, the input goes down with the next one */
+    m->copied = 0;
+    if(Next(m, in) != 0)
+    {
+      /* the records already copied are given, the error goes next call */
+      m->failed = 1;
+      return done;
+    }
+    if(in->size == 0) m->heap[0] = m->heap[--m->heap_size];
+    SiftDown(m, 0);
+  }
+
+  return done;
+}
+
+/* parse the "Merge" value of the channel. return 0 if there is none */
+static int ParseMerge(const struct ChannelDesc *channel,
+    char *value, struct Merge *m)
+{
+  char *names[] = MERGE_KEY_NAMES;
+  char *tokens[MERGE_ATTRIBUTES + 1];
+  int count;
+
+  count = ParseValue(value, ",", tokens, MERGE_ATTRIBUTES + 1);
+  if(count == 0) return 0;
+
+  ZLOGFAIL(count != MERGE_ATTRIBUTES, EFAULT,
+      "Merge has invalid number of arguments");
+  m->record = ATOI(tokens[1]);
+  m->offset = ATOI(tokens[2]);
+  m->size = ATOI(tokens[3]);
+  for(m->type = 0; m->type < MergeKeyTypesNumber; ++m->type)
+    if(STREQ(tokens[4], names[m->type])) break;
+
+  ZLOGFAIL(m->type == MergeKeyTypesNumber, EFAULT,
+      "%s has invalid key type %s", channel->alias, tokens[4]);
+  ZLOGFAIL(m->record < 0 || m->record > RECORD_MAX, EFAULT,
+      "%s has invalid record size", channel->alias);
+  ZLOGFAIL(m->offset < 0 || m->size <= 0, EFAULT,
+      "%s has invalid key", channel->alias);
+  ZLOGFAIL(m->record > 0 && m->offset + m->size > m->record, EFAULT,
+      "%s key is out of the record", channel->alias);
+  ZLOGFAIL((m->type == MergeKeyInt || m->type == MergeKeyUint)
+      && m->size != 1 && m->size != 2 && m->size != 4 && m->size != 8,
+      EFAULT, "%s has invalid integer key size", channel->alias);
+  ZLOGFAIL(m->type == MergeKeyFloat && m->size != sizeof(float)
+      && m->size != sizeof(double), EFAULT,
+      "%s has invalid float key size", channel->alias);
+  return 1;
+}
+
+/* fail if the input is not the sequentially readable channel */
+static void CheckInput(const struct ChannelDesc *channel,
+    const struct ChannelDesc *input)
+{
+  ZLOGFAIL(input->source == ChannelMerge, EFAULT,
+      "%s cannot merge the merge channel %s", channel->alias, input->alias);
+  ZLOGFAIL(!input->limits[GetsLimit] || !input->limits[GetSizeLimit]
+      || input->type == RGetSPut || input->type == RGetRPut, EFAULT,
+      "%s input %s is not sequentially readable", channel->alias, input->alias);
+}
+
+int MergeChannelCtor(struct NaClApp *nap, struct ChannelDesc *channel)
+{
+  char *names[] = MERGE_KEY_NAMES;
+  struct ChannelDesc *inputs[MAX_CHANNELS_NUMBER];
+  struct Merge merge = {0};
+  struct Merge *m;
+  int count;
+  int i;
+
+  assert(nap != NULL);
+  assert(channel != NULL);
+  assert(channel->source == ChannelMerge);
+
+  ZLOGFAIL(channel->type != SGetSPut, EFAULT,
+      "%s is a merge channel and must be sequential", channel->alias);
+  ZLOGFAIL(channel->limits[PutsLimit] && channel->limits[PutSizeLimit], EFAULT,
+      "%s is a merge channel and must be read-only", channel->alias);
+
+  /* the key */
+  ZLOGFAIL(!ParseMerge(channel, GetValueByAlias(MFT_MERGE, channel->alias), &merge),
+      EFAULT, "%s has no Merge key", channel->alias);
+
+  /* the inputs */
+  count = GetChannelInputs(nap, channel, MERGE_PREFIX, inputs);
+
+  m = g_memdup(&merge, sizeof merge);
+  m->count = count;
+  m->inputs = g_malloc0(count * sizeof *m->inputs);
+  m->heap = g_malloc(count * sizeof *m->heap);
+  for(i = 0; i < count; ++i)
+  {
+    struct Input *in = &m->inputs[i];
+
+    CheckInput(channel, inputs[i]);
+    in->channel = inputs[i];
+    in->capacity = MERGE_BUFFER_SIZE;
+    in->buffer = g_malloc(in->capacity);
+  }
+
+  channel->socket = m;
+  channel->handle = -1;
+  channel->size = 0;
+  channel->getpos = 0;
+  channel->putpos = 0;
+  ZLOGS(LOG_DEBUG, "%s merges %d inputs by %s key %d:%d", channel->alias,
+      count, names[m->type], m->offset, m->size);
+  return 0;
+}
+
+int MergeChannelDtor(struct ChannelDesc *channel)
+{
+  struct Merge *m;
+  int i;
+
+  assert(channel != NULL);
+  assert(channel->socket != NULL);
+
+  m = channel->socket;
+  for(i = 0; i < m->count; ++i)
+    g_free(m->inputs[i].buffer);
+
+  if(channel->tag != NULL)
+  {
+    TagDigest(channel->tag, channel->digest);
+    TagDtor(channel->tag);
+    channel->tag = NULL;
+  }
+
+  ZLOGS(LOG_DEBUG, "%s closed with tag %s, getsize %ld",
+      channel->alias, channel->digest, channel->counters[GetSizeLimit]);
+  g_free(m->heap);
+  g_free(m->inputs);
+  g_free(m);
+  channel->socket = NULL;
+  return 0;
+}
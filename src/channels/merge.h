@@ -0,0 +1,64 @@
+/*
+ * merge channel. the ordered merge of the sorted input channels
+ * (regular files or network) by the record key. the user reads one
+ * ordered stream, zerovm keeps the heap of the inputs heads
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MERGE_H_
+#define MERGE_H_
+
+#include "src/channels/mount_channel.h"
+
+#define MERGE_PREFIX "merge:"
+#define MERGE_ATTRIBUTES 5 /* alias, record size, key offset, key size, key type */
+#define MERGE_BUFFER_SIZE 0x100000 /* each input buffer */
+
+/* merge key types */
+enum MergeKeyType {
+  MergeKeyBytes, /* unsigned bytes (memcmp order) */
+  MergeKeyInt, /* little endian signed integer of 1, 2, 4 or 8 bytes */
+  MergeKeyUint, /* little endian unsigned integer of 1, 2, 4 or 8 bytes */
+  MergeKeyFloat, /* float (4 bytes) or double (8 bytes) */
+  MergeKeyTypesNumber
+};
+
+/* key type names (should be in synch with MergeKeyType) */
+#define MERGE_KEY_NAMES { \
+  "bytes", /* MergeKeyBytes */\
+  "int", /* MergeKeyInt */\
+  "uint", /* MergeKeyUint */\
+  "float", /* MergeKeyFloat */\
+  "invalid"\
+}
+
+/*
+ * construct the merge channel "merge:alias1+alias2+...". the inputs
+ * are the channels mounted before, the key is taken from the manifest
+ * "Merge" key. return 0 if successful
+ */
+int MergeChannelCtor(struct NaClApp *nap, struct ChannelDesc *channel);
+
+/*
+ * read the next "count" bytes of the ordered stream. return the read
+ * bytes number (0 - all inputs reached eof) or -1 if failed
+ */
+int32_t MergeFetch(struct ChannelDesc *channel, char *buf, int32_t count);
+
+/* release the merge channel. the inputs are closed as usual channels */
+int MergeChannelDtor(struct ChannelDesc *channel);
+
+#endif /* MERGE_H_ */
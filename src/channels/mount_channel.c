@@ -24,6 +24,11 @@
 #include "src/main/manifest_parser.h"
 #include "src/channels/preload.h"
 #include "src/channels/prefetch.h"
+#include "src/channels/ring.h"
+#include "src/channels/collective.h"
+#include "src/channels/merge.h"
+#include "src/channels/queue.h"
+#include "src/channels/record.h"
 #include "src/channels/mount_channel.h"
 
 GTree *aliases;
@@ -61,8 +66,12 @@ static enum ChannelSourceType GetSourceType(const char *name)
 
   assert(name != NULL);
 
-  /* unlike local network channels always contain ':'s */
-  if(strchr(name, ':') == NULL)
+  /* unlike local network (and merge, queue) channels always contain ':'s */
+  if(strncmp(name, MERGE_PREFIX, sizeof MERGE_PREFIX - 1) == 0)
+    type = ChannelMerge;
+  else if(strncmp(name, QUEUE_PREFIX, sizeof QUEUE_PREFIX - 1) == 0)
+    type = ChannelQueue;
+  else if(strchr(name, ':') == NULL)
     type = GetChannelSource(name);
   else
     type = GetChannelProtocol(name);
@@ -137,6 +146,17 @@ static void ChannelCtor(struct NaClApp *nap, char **tokens)
         "%s has invalid %dth limit", tokens[ChannelAlias], i);
   }
 
+  /* duplex network channel has the separate tag for the written data */
+  channel->duplex = channel->source == ChannelTCP
+      && channel->limits[GetsLimit] && channel->limits[GetSizeLimit]
+      && channel->limits[PutsLimit] && channel->limits[PutSizeLimit];
+  channel->wtag = NULL;
+  if(channel->duplex && channel->tag != NULL)
+  {
+    channel->wtag = TagCtor();
+    memset(channel->wdigest, 0, TAG_DIGEST_SIZE);
+  }
+
   /* mount given channel */
   switch(channel->source)
   {
@@ -148,12 +168,22 @@ static void ChannelCtor(struct NaClApp *nap, char **tokens)
     case ChannelTCP:
       code = PrefetchChannelCtor(channel);
       break;
+    case ChannelIPC:
+      code = RingChannelCtor(channel);
+      break;
+    case ChannelMerge:
+      code = MergeChannelCtor(nap, channel);
+      break;
+    case ChannelQueue:
+      code = QueueChannelCtor(nap, channel);
+      break;
     default:
       ZLOGFAIL(1, EPROTONOSUPPORT, "%s has invalid type: %s",
           channel->alias, StringizeChannelSourceType(channel->source));
       break;
   }
   ZLOGFAIL(code, EFAULT, "cannot allocate %s", channel->alias);
+  RecordChannelCtor(channel);
   channel->mounted = MOUNTED;
 }
 
@@ -165,6 +195,9 @@ static void ChannelDtor(struct ChannelDesc *channel)
   /* quit if channel isn't mounted */
   if(channel->mounted != MOUNTED) return;
 
+  /* the read ahead data goes to the tag before the digest is made */
+  RecordChannelDtor(channel);
+
   switch(channel->source)
   {
     case ChannelRegular:
@@ -181,6 +214,17 @@ static void ChannelDtor(struct ChannelDesc *channel)
       if(GetExitCode() == 0)
         PrefetchChannelDtor(channel);
       break;
+    case ChannelIPC:
+      /* same as for the network channels */
+      if(GetExitCode() == 0)
+        RingChannelDtor(channel);
+      break;
+    case ChannelMerge:
+      MergeChannelDtor(channel);
+      break;
+    case ChannelQueue:
+      QueueChannelDtor(channel);
+      break;
     default:
       ZLOG(LOG_ERR, "%s has invalid type %s",
           channel->alias, StringizeChannelSourceType(channel->source));
@@ -189,6 +233,80 @@ static void ChannelDtor(struct ChannelDesc *channel)
   channel->mounted = !MOUNTED;
 }
 
+int32_t ChannelRead(struct ChannelDesc *channel, char *buf, int32_t size, int64_t offset)
+{
+  int32_t result = -1;
+
+  assert(channel != NULL);
+  assert(buf != NULL);
+
+  switch(channel->source)
+  {
+    case ChannelRegular:
+      result = pread(channel->handle, buf, (size_t)size, (off_t)offset);
+      if(result == -1) result = -errno;
+      break;
+    case ChannelCharacter:
+    case ChannelFIFO:
+      result = fread(buf, 1, (size_t)size, (FILE*)channel->socket);
+      if(result == -1) result = -errno;
+      break;
+    case ChannelTCP:
+      result = FetchMessage(channel, buf, size);
+      if(result == -1) result = -EIO;
+      break;
+    case ChannelIPC:
+      result = RingFetch(channel, buf, size);
+      if(result == -1) result = -EIO;
+      break;
+    case ChannelMerge:
+      result = MergeFetch(channel, buf, size);
+      if(result == -1) result = -EIO;
+      break;
+    case ChannelQueue:
+      result = QueueFetch(channel, buf, size);
+      if(result == -1) result = -errno;
+      break;
+    default: /* design error */
+      ZLOGFAIL(1, EFAULT, "invalid channel source");
+      break;
+  }
+  return result;
+}
+
+int GetChannelInputs(struct NaClApp *nap, const struct ChannelDesc *channel,
+    const char *prefix, struct ChannelDesc **inputs)
+{
+  struct SystemManifest *mft = nap->system_manifest;
+  char name[BIG_ENOUGH_STRING];
+  char *aliases[MAX_CHANNELS_NUMBER];
+  int count;
+  int i;
+
+  assert(nap != NULL);
+  assert(channel != NULL);
+  assert(prefix != NULL);
+  assert(inputs != NULL);
+
+  g_strlcpy(name, channel->name + strlen(prefix), BIG_ENOUGH_STRING);
+  count = ParseValue(name, "+", aliases, MAX_CHANNELS_NUMBER);
+  ZLOGFAIL(count == 0, EFAULT, "%s has no inputs", channel->alias);
+
+  for(i = 0; i < count; ++i)
+  {
+    int j;
+
+    for(j = 0; j < mft->channels_count; ++j)
+      if(mft->channels[j].mounted == MOUNTED
+          && STREQ(mft->channels[j].alias, aliases[i])) break;
+
+    ZLOGFAIL(j == mft->channels_count, EFAULT,
+        "%s input %s must be mounted before", channel->alias, aliases[i]);
+    inputs[i] = &mft->channels[j];
+  }
+  return count;
+}
+
 void ChannelsCtor(struct NaClApp *nap)
 {
   int i;
@@ -238,12 +356,39 @@ void ChannelsCtor(struct NaClApp *nap)
 
   ResetAliases();
 
+  /* the collective group channels are registered with the user ones */
+  CollectiveCtor(nap);
+
   /* 2nd pass for the network channels if name service specified */
   KickPrefetchChannels(nap);
 }
 
+/* the thread pool worker closing the local channel */
+static void CloseChannel(gpointer data, gpointer user_data)
+{
+  ChannelDtor(data);
+}
+
+/* return not 0 if the channel close does not touch the shared state */
+static int IsLocal(const struct ChannelDesc *channel)
+{
+  switch(channel->source)
+  {
+    case ChannelRegular:
+    case ChannelCharacter:
+    case ChannelFIFO:
+    case ChannelMerge:
+    case ChannelQueue:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
 void ChannelsFinalizer(struct NaClApp *nap)
 {
+  GThreadPool *closer = NULL;
+  char *tagged;
   int i;
 
   /* exit if channels are not constructed */
@@ -252,18 +397,45 @@ void ChannelsFinalizer(struct NaClApp *nap)
   if(nap->system_manifest == NULL) return;
   if(nap->system_manifest->channels == NULL) return;
 
+  /*
+   * the local channels (truncation, digests) are closed by the thread
+   * pool while the network ones are drained here. the failed session
+   * can get here from the signal handler, it closes channels serially
+   */
+  if(GetExitCode() == 0)
+    closer = ThreadPoolCtor(CloseChannel, 0);
+
+  tagged = g_malloc0(nap->system_manifest->channels_count);
   for(i = 0; i < nap->system_manifest->channels_count; ++i)
   {
     struct ChannelDesc *channel = &nap->system_manifest->channels[i];
-    if(channel->tag != NULL)
-    {
-      ChannelDtor(channel);
-      g_string_append_printf(nap->channels_tag, "%s %s ",
-          channel->alias, channel->digest);
-    }
+
+    tagged[i] = channel->tag != NULL;
+    if(closer != NULL && IsLocal(channel))
+      g_thread_pool_push(closer, channel, NULL);
     else
       ChannelDtor(channel);
   }
+  if(closer != NULL)
+    g_thread_pool_free(closer, FALSE, TRUE);
+
+  /* the digests in the channels order */
+  for(i = 0; i < nap->system_manifest->channels_count; ++i)
+  {
+    struct ChannelDesc *channel = &nap->system_manifest->channels[i];
+    if(!tagged[i]) continue;
+
+    g_string_append_printf(nap->channels_tag, "%s %s ",
+        channel->alias, channel->digest);
+
+    /* duplex channel reports the read and the written data digests */
+    if(channel->duplex)
+      g_string_append_printf(nap->channels_tag, "%s %s ",
+          channel->alias, channel->wdigest);
+  }
+  g_free(tagged);
+
+  CollectiveDtor();
 }
 
 void ChannelsDtor(struct NaClApp *nap)
@@ -60,12 +60,14 @@ enum ChannelSourceType {
   ChannelFIFO, /* not tested */
   ChannelLink, /* not supported */
   ChannelSocket, /* not supported */
-  ChannelIPC, /* to remove */
+  ChannelIPC, /* supported (shared memory ring) */
   ChannelTCP, /* supported */
   ChannelINPROC, /* not supported */
   ChannelPGM, /* not supported */
   ChannelEPGM, /* not supported */
   ChannelUDP, /* going to be supported in the future */
+  ChannelMerge, /* supported (ordered merge of the other channels) */
+  ChannelQueue, /* supported (splits of the other channels on demand) */
   ChannelSourceTypeNumber
 };
 
@@ -84,6 +86,22 @@ enum ChannelSourceType {
   "pgm", /* ChannelPGM */\
   "epgm", /* ChannelEPGM */\
   "udp", /* ChannelUDP */\
+  "merge", /* ChannelMerge */\
+  "queue", /* ChannelQueue */\
+  "invalid"\
+}
+
+/* network channels transport (selected by the manifest "Transport" key) */
+enum ChannelTransport {
+  TransportZMQ, /* default */
+  TransportNative, /* length-framed tcp stream over epoll */
+  ChannelTransportNumber
+};
+
+/* transport names (should be in synch with ChannelTransport) */
+#define CHANNEL_TRANSPORT_NAMES { \
+  "zmq", /* TransportZMQ */\
+  "native", /* TransportNative */\
   "invalid"\
 }
 
@@ -95,6 +113,8 @@ struct ChannelDesc
   void *tag; /* tag context */
   char digest[TAG_DIGEST_SIZE]; /* tag hexadecimal digest */
   char control[TAG_DIGEST_SIZE]; /* received digest */
+  void *wtag; /* duplex channel: tag context of the written data */
+  char wdigest[TAG_DIGEST_SIZE]; /* duplex channel: written data digest */
 
   int32_t handle; /* file handle. fit only for regular files */
   void *socket; /* can be used both by network and local channel */
@@ -105,6 +125,18 @@ struct ChannelDesc
   zmq_msg_t msg; /* 0mq message container. should be initialized */
   int32_t bufpos; /* index of the 1st available byte in the buffer */
   int32_t bufend; /* index of the 1st unavailable byte in the buffer */
+  /* group #2.3 */
+  enum ChannelTransport transport; /* network channel transport */
+  int32_t poller; /* native transport epoll handle */
+  int64_t frame; /* native transport bytes left in the incoming frame */
+  int64_t sent; /* native transport bytes sent since the cancel check */
+  int8_t ready; /* native transport connection established */
+  int8_t listener; /* native transport accepts the connection ("bind" side) */
+  int8_t cancelled; /* the reader stopped before eof (native and ring channels) */
+  struct ChannelDesc *peers; /* broadcast channel subscribers */
+  int32_t peers_count; /* broadcast channel subscribers number */
+  void *partition; /* broadcast channel records router (see partition.c) */
+  void *record; /* record framed channel read ahead (see record.c) */
 
   enum AccessType type; /* type of access sequential/random */
   enum ChannelSourceType source; /* network or local file */
@@ -117,6 +149,7 @@ struct ChannelDesc
 
   /* added to serve sequential channels */
   int8_t eof; /* if not 0 the channel reached eof at the last operation */
+  int8_t duplex; /* readable and writable network channel */
   int8_t mounted; /* MOUNTED or !MOUNTED */
 };
 
@@ -132,6 +165,21 @@ void ChannelsDtor(struct NaClApp *nap);
 /* get string containing protocol name by channel source type */
 char *StringizeChannelSourceType(enum ChannelSourceType type);
 
+/*
+ * read the channel source. "offset" is only used by the regular files.
+ * the channel counters and tag are not touched. return the read bytes
+ * number or -errno
+ */
+int32_t ChannelRead(struct ChannelDesc *channel, char *buf, int32_t size, int64_t offset);
+
+/*
+ * get the inputs of the merge or queue channel ("prefix" followed by the
+ * "+" separated aliases): the channels mounted before it. "inputs" must
+ * have MAX_CHANNELS_NUMBER space. return the inputs number
+ */
+int GetChannelInputs(struct NaClApp *nap, const struct ChannelDesc *channel,
+    const char *prefix, struct ChannelDesc **inputs);
+
 EXTERN_C_END
 
 #endif /* MOUNT_CHANNEL_H_ */
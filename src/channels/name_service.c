@@ -18,6 +18,8 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include "src/main/tools.h"
 #include "src/main/zlog.h"
 #include "src/main/manifest_parser.h"
@@ -36,8 +38,17 @@ static GHashTable *netlist = NULL;
 static void *connects_index = NULL; /* points to the "connect" list start */
 static uint32_t binds = 0; /* "bind" channel number */
 static uint32_t connects = 0; /* "connect" channel number */
+static uint32_t job = 0; /* job id */
+static uint32_t nodes = 0; /* job nodes number */
+static uint32_t self = 0; /* own node id */
 static struct ChannelConnection *nameservice = NULL;
 
+/* the registration sent to the name server but not answered yet */
+static struct ChannelNSRecord *parcel = NULL;
+static struct NSHeader request;
+static int ns_sock = -1;
+static int work_sock = -1; /* the work queue requests */
+
 /* test the channel for validity */
 static void FailOnInvalidNetChannel(const struct ChannelDesc *channel)
 {
@@ -45,8 +56,13 @@ static void FailOnInvalidNetChannel(const struct ChannelDesc *channel)
       "%s has invalid protocol %s", channel->alias, channel->source);
   ZLOGFAIL(channel->type != SGetSPut, EFAULT,
       "%s is a network channel and must be sequential", channel->alias);
-  ZLOGFAIL(channel->limits[GetsLimit] && channel->limits[PutsLimit] != 0,
-      EFAULT, "%s is a network channel and must be read-only or write-only",
+  ZLOGFAIL(channel->duplex && channel->transport != TransportNative, EFAULT,
+      "%s is a duplex channel and needs native transport", channel->alias);
+  ZLOGFAIL(channel->duplex && !NameServiceSet(), EFAULT,
+      "%s is a duplex channel and needs name service", channel->alias);
+  ZLOGFAIL(!channel->duplex && channel->limits[GetsLimit]
+      && channel->limits[PutsLimit] != 0, EFAULT,
+      "%s is a network channel and must be read-only, write-only or duplex",
       channel->alias);
 }
 
@@ -120,8 +136,18 @@ static void ParseURL(const struct ChannelDesc *channel,
   ZLOGFAIL(record->host == 0, ENXIO,
       "%s has invalid url %s", channel->alias, channel->name);
 
-  /* mark the channel as "bind", "connect" or "outsider" */
-  if(record->port != 0) record->mark = OUTSIDER_MARK;
+  /*
+   * mark the channel as "bind", "connect" or "outsider". the peers
+   * of the duplex channel agree on the roles by the node ids: the
+   * lower node id binds, the higher one connects
+   */
+  if(channel->duplex)
+  {
+    ZLOGFAIL(record->port != 0 || record->host == self, EFAULT,
+        "%s is a duplex channel and must have the peer node id", channel->alias);
+    record->mark = self < record->host ? BIND_MARK : CONNECT_MARK;
+  }
+  else if(record->port != 0) record->mark = OUTSIDER_MARK;
   else record->mark = channel->limits[GetsLimit]
       && channel->limits[GetSizeLimit] ? BIND_MARK : CONNECT_MARK;
 }
@@ -129,16 +155,28 @@ static void ParseURL(const struct ChannelDesc *channel,
 void StoreChannelConnectionInfo(const struct ChannelDesc *channel)
 {
   struct ChannelConnection *record;
+  struct ChannelConnection *twin;
 
   assert(channel != NULL);
 
   /* allocate the hash table record */
-  record = g_malloc(sizeof *record);
+  record = g_malloc0(sizeof *record);
 
   /* prepare and store the channel connection record */
   ZLOGS(LOG_DEBUG, "validating %s", channel->alias);
   FailOnInvalidNetChannel(channel);
   ParseURL(channel, record);
+  record->alias = channel->alias;
+
+  /*
+   * the name service keeps one "bind" and one "connect" slot per peer.
+   * the second channel in the slot (e.g. user channel to the collective
+   * group neighbour, see channels.txt) would replace the first one
+   */
+  twin = g_hash_table_lookup(netlist, GUINT_TO_POINTER(MakeKey(record)));
+  ZLOGFAIL(twin != NULL && record->mark != OUTSIDER_MARK, EFAULT,
+      "%s and %s take the same connection slot to host %u",
+      twin->alias, channel->alias, record->host);
   g_hash_table_insert(netlist, GUINT_TO_POINTER(MakeKey(record)), record);
 }
 
@@ -184,143 +222,378 @@ static void NSRecordSerializer(gpointer key, gpointer value, gpointer buffer)
   p->id = bswap_32(record->host);
   p->ip = 0;
   p->port = bswap_16(record->port);
+  p->flags = record->mark == BIND_MARK && record->local ? NS_LOCAL_FLAG : 0;
 }
 
 /*
- * create parcel (in provided place) for the name server
- * return the real parcel size. bswap_32 will work only on big endian
+ * create parcel (in provided place) for the name server: "bind"
+ * records followed by "connect" records. the parcel must have
+ * space for binds + connects records
  */
-static int32_t ParcelCtor(const struct NaClApp *nap,
-    char *parcel, uint32_t size)
+static void ParcelCtor(struct ChannelNSRecord *records)
 {
-  char *p = parcel; /* parcel pointer */
-  uint32_t node_id_network = bswap_32(nap->system_manifest->node);
-  uint32_t binds_network = bswap_32(binds);
-  uint32_t connects_network = bswap_32(connects);
+  uint32_t all_binds = binds;
+  uint32_t all_connects = connects;
 
-  /* asserts and checks */
-  assert(parcel != NULL);
-  assert(size >= connects * sizeof(struct ChannelNSRecord) + PARCEL_OVERHEAD);
+  assert(records != NULL);
 
   /*
    * iterate through netlist. will update "binds" and "connects"
    * the parcel will be updated with "bind" and "connect" lists
    */
-  connects_index = parcel + PARCEL_NODE_ID + PARCEL_BINDS
-      + binds * PARCEL_REC_SIZE + PARCEL_CONNECTS;
-  g_hash_table_foreach(netlist, NSRecordSerializer,
-      parcel + PARCEL_NODE_ID + PARCEL_BINDS);
+  connects_index = records + binds;
+  g_hash_table_foreach(netlist, NSRecordSerializer, records);
   assert(binds + connects == 0);
 
   /* restore "binds" and "connects" */
-  binds = bswap_32(binds_network);
-  connects = bswap_32(connects_network);
+  binds = all_binds;
+  connects = all_connects;
+}
+
+/* return the fragments number needed to send given records number */
+static INLINE uint32_t Fragments(uint32_t records)
+{
+  return records == 0 ? 1 : (records - 1) / NS_FRAGMENT_RECORDS + 1;
+}
+
+/* initialize the datagram header (in the network order) */
+static void HeaderCtor(struct NSHeader *header, uint32_t node)
+{
+  memset(header, 0, sizeof *header);
+  header->magic = bswap_32(NS_MAGIC);
+  header->version = NS_VERSION;
+  header->type = NS_REQUEST;
+  header->fragments = bswap_16(Fragments(binds + connects));
+  header->job = bswap_32(job);
+  header->nodes = bswap_32(nodes);
+  header->node = bswap_32(node);
+  header->binds = bswap_32(binds);
+  header->connects = bswap_32(connects);
+}
+
+/* send all request fragments to the name server */
+static void SendRequest(int sock, struct NSHeader *header,
+    const struct ChannelNSRecord *parcel)
+{
+  char datagram[NS_DATAGRAM_SIZE];
+  uint32_t records = binds + connects;
+  uint32_t i;
+
+  for(i = 0; i < Fragments(records); ++i)
+  {
+    uint32_t first = i * NS_FRAGMENT_RECORDS;
+    uint32_t count = MIN(records - first, NS_FRAGMENT_RECORDS);
+    uint32_t size = sizeof *header + count * PARCEL_REC_SIZE;
 
-  /* put the node id into the parcel */
-  memcpy(p, &node_id_network, sizeof node_id_network);
+    header->fragment = bswap_16(i);
+    memcpy(datagram, header, sizeof *header);
+    memcpy(datagram + sizeof *header, parcel + first, count * PARCEL_REC_SIZE);
 
-  /* put the the "binds counter" into the parcel */
-  p += PARCEL_NODE_ID;
-  memcpy(p, &binds_network, PARCEL_BINDS);
+    /* lost datagrams will be re-sent after timeout */
+    ZLOGIF(send(sock, datagram, size, 0) != size,
+        "failed to send parcel fragment %u: %s", i, strerror(errno));
+  }
+}
 
-  /* put the the "connects counter" into the parcel */
-  p += PARCEL_BINDS + PARCEL_REC_SIZE * binds;
-  memcpy(p, &connects_network, PARCEL_CONNECTS);
+/* return milliseconds left to the deadline */
+static int TimeLeft(const struct timespec *deadline)
+{
+  struct timespec now;
 
-  /* return the actual parcel size */
-  return PARCEL_OVERHEAD + PARCEL_REC_SIZE * binds +  PARCEL_REC_SIZE * connects;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return MAX(0, (deadline->tv_sec - now.tv_sec) * 1000
+      + (deadline->tv_nsec - now.tv_nsec) / 1000000);
 }
 
 /*
- * send the parcel to the name server and get the answer
- * return the actual parcel size
- * note: given parcel variable will be updated with the ns answer
+ * receive reply fragments until all received or "timeout" (milliseconds)
+ * expired. update the records and "received" map. return the number of
+ * fragments still missing
  */
-static int32_t SendParcel(char *parcel, uint32_t size)
+static uint32_t ReceiveReply(int sock, const struct NSHeader *request,
+    struct ChannelNSRecord *records, uint8_t *received, uint32_t left, int timeout)
 {
-  int ns_socket;
-  int32_t result;
-  struct sockaddr_in ns;
-  uint32_t ns_len = sizeof ns;
+  struct timespec deadline;
+  uint32_t fragments = Fragments(binds + connects);
 
-  assert(parcel != NULL);
-  assert(size > 0);
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout / 1000;
+  deadline.tv_nsec += timeout % 1000 * 1000000;
+
+  while(left > 0)
+  {
+    char datagram[NS_DATAGRAM_SIZE];
+    struct NSHeader *header = (void*)datagram;
+    struct pollfd pfd;
+    uint32_t first;
+    uint32_t count;
+    int size;
+
+    /* wait for the next datagram */
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    size = poll(&pfd, 1, TimeLeft(&deadline));
+    if(size == 0) break;
+    if(size < 0)
+    {
+      ZLOGFAIL(errno != EINTR, errno, "cannot poll the name server");
+      continue;
+    }
+    size = recv(sock, datagram, sizeof datagram, 0);
+
+    /* drop invalid, alien and duplicated fragments */
+    if(size < (int)sizeof *header) continue;
+    if(header->magic != request->magic || header->version != NS_VERSION
+        || header->type != NS_REPLY || header->job != request->job
+        || header->node != request->node || header->binds != request->binds
+        || header->connects != request->connects
+        || bswap_16(header->fragments) != fragments) continue;
+    first = bswap_16(header->fragment);
+    if(first >= fragments || received[first]) continue;
+    first *= NS_FRAGMENT_RECORDS;
+    count = MIN(binds + connects - first, NS_FRAGMENT_RECORDS);
+    if(size != sizeof *header + count * PARCEL_REC_SIZE) continue;
+
+    memcpy(records + first, datagram + sizeof *header, count * PARCEL_REC_SIZE);
+    received[bswap_16(header->fragment)] = 1;
+    --left;
+  }
+
+  return left;
+}
+
+/* return the udp socket connected to the name server */
+static int NameServerSocket()
+{
+  struct sockaddr_in ns;
+  int sock;
 
-  /* connect to the name server */
-  ns_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  ZLOGFAIL(sock < 0, errno, "cannot create name service socket");
   ns.sin_addr.s_addr = bswap_32(nameservice->host);
   ns.sin_port = bswap_16(nameservice->port);
   ns.sin_family = AF_INET;
+  ZLOGFAIL(connect(sock, (void*)&ns, sizeof ns) != 0,
+      errno, "cannot connect to the name server");
+  return sock;
+}
 
-  /* send the parcel to the name server */
-  result = sendto(ns_socket, parcel, size, 0, (void*)&ns, sizeof ns);
-  ZLOGFAIL(result == -1, errno, "failed to send parcel to the name server");
+/*
+ * send the parcel to the name server. the answer is taken (and the
+ * request repeated if needed) later by CompleteParcel()
+ */
+static void SendParcel(uint32_t node)
+{
+  assert(parcel != NULL);
+  ZLOGFAIL(Fragments(binds + connects) > NS_FRAGMENTS_MAX, EFAULT,
+      "too many network channels");
 
-  /* receive the parcel back */
-  result = recvfrom(ns_socket, parcel, size, 0, (void*)&ns, &ns_len);
-  ZLOGFAIL(result == -1, errno, "failed to receive parcel from the name server");
-  close(ns_socket);
+  ns_sock = NameServerSocket();
+  HeaderCtor(&request, node);
+  SendRequest(ns_sock, &request, parcel);
+}
 
-  return result;
+/*
+ * get the answer to the sent parcel. the request is repeated with
+ * exponential backoff until the whole reply received
+ * note: the parcel records will be updated with the answer
+ */
+static void CompleteParcel()
+{
+  uint8_t *received;
+  uint32_t left = Fragments(binds + connects);
+  int timeout = NS_TIMEOUT_MIN;
+
+  /* wait for the answer, repeat request until it received (or session timeout) */
+  received = g_malloc0(left);
+  for(;;)
+  {
+    left = ReceiveReply(ns_sock, &request, parcel, received, left, timeout);
+    if(left == 0) break;
+
+    ZLOGS(LOG_DEBUG, "%u reply fragments missing, retry in %d ms", left, timeout);
+    timeout = MIN(timeout * 2, NS_TIMEOUT_MAX);
+    SendRequest(ns_sock, &request, parcel);
+  }
+
+  g_free(received);
+  close(ns_sock);
+  ns_sock = -1;
 }
 
-/* decode the parcel and update netlist */
-static void DecodeParcel(const char *parcel, uint32_t count)
+/* decode the records of the parcel and update netlist */
+static void DecodeParcel(const struct ChannelNSRecord *records)
 {
   uint32_t i;
-  const struct ChannelNSRecord *records;
-  uint32_t size = (count - NS_PARCEL_OVERHEAD) / PARCEL_REC_SIZE;
 
-  assert(parcel != NULL);
-  assert(bswap_32(*(uint32_t*)parcel) == size);
-  if(size == 0) return;
+  assert(records != NULL);
 
   /* take a record by record from the parcel and update netlist */
-  records = (void*)(parcel + PARCEL_CONNECTS);
-  for(i = 0; i < size; ++i)
+  for(i = 0; i < binds + connects; ++i)
   {
     struct ChannelConnection r, *record = &r;
 
     /* get the connection record from netlist */
     record->host = bswap_32(records[i].id);
-    record->mark = CONNECT_MARK;
+    record->mark = i < binds ? BIND_MARK : CONNECT_MARK;
     record = g_hash_table_lookup(netlist, GUINT_TO_POINTER(MakeKey(record)));
-    assert(record != NULL);
+    ZLOGFAIL(record == NULL, EFAULT, "name server returned unknown host %u",
+        bswap_32(records[i].id));
+
+    /* the "bind" channel listens on the local endpoint if the peer is local */
+    if(i < binds)
+    {
+      record->local = records[i].flags & NS_LOCAL_FLAG;
+      if(record->local)
+        ZLOGS(LOG_DEBUG, "host %u is local", bswap_32(records[i].id));
+      continue;
+    }
 
     /* update the record */
     record->port = bswap_16(records[i].port);
     record->host = bswap_32(records[i].ip);
-    assert(record->host != 0);
-    assert(record->port != 0);
+    ZLOGFAIL(record->host == 0 || record->port == 0, EFAULT,
+        "name server returned invalid address for host %u",
+        bswap_32(records[i].id));
+
+    /* the peer is on the same host. switch the channel to local endpoint */
+    if(records[i].flags & NS_LOCAL_FLAG)
+    {
+      record->protocol = ChannelIPC;
+      ZLOGS(LOG_DEBUG, "host %u is local", bswap_32(records[i].id));
+    }
   }
 }
 
-void ResolveChannels(const struct NaClApp *nap, uint32_t all_binds, uint32_t all_connects)
+void RegisterChannels(const struct NaClApp *nap, uint32_t all_binds, uint32_t all_connects)
 {
-  char parcel[PARCEL_SIZE];
-  int32_t parcel_size = PARCEL_SIZE;
+  assert(nap != NULL);
+  assert(parcel == NULL);
 
   binds = all_binds;
   connects = all_connects;
 
-  assert(binds + connects <= PARCEL_CAPACITY);
-  assert(nap != NULL);
-
   /* construct the parcel from netlist */
-  parcel_size = ParcelCtor(nap, parcel, parcel_size);
-  if(parcel_size == 0) return;
+  parcel = g_malloc0((binds + connects + 1) * PARCEL_REC_SIZE);
+  ParcelCtor(parcel);
 
-  /* send it to name server and get the answer */
-  parcel_size = SendParcel(parcel, parcel_size);
-  assert(parcel_size == NS_PARCEL_OVERHEAD + connects * PARCEL_REC_SIZE);
+  /* send it to name server. the answer will be taken by ResolveChannels() */
+  SendParcel(nap->system_manifest->node);
+}
+
+void ResolveChannels()
+{
+  if(parcel == NULL) return;
 
-  /* decode the parcel and update netlist */
-  DecodeParcel(parcel, parcel_size);
+  /* get the answer, decode the parcel and update netlist */
+  CompleteParcel();
+  DecodeParcel(parcel);
+  g_free(parcel);
+  parcel = NULL;
+}
+
+/*
+ * wait for the work reply until "timeout" (milliseconds) expired.
+ * return 0 and update "split" if the reply received
+ */
+static int ReceiveSplit(int sock, const char *request, uint32_t *split, int timeout)
+{
+  const struct NSHeader *req_header = (const void*)request;
+  const struct NSWork *req_work = (const void*)(request + sizeof *req_header);
+  struct timespec deadline;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout / 1000;
+  deadline.tv_nsec += timeout % 1000 * 1000000;
+
+  for(;;)
+  {
+    char datagram[NS_DATAGRAM_SIZE];
+    struct NSHeader *header = (void*)datagram;
+    struct NSWork *work = (void*)(datagram + sizeof *header);
+    struct pollfd pfd;
+    int size;
+
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    size = poll(&pfd, 1, TimeLeft(&deadline));
+    if(size == 0) return -1;
+    if(size < 0)
+    {
+      ZLOGFAIL(errno != EINTR, errno, "cannot poll the name server");
+      continue;
+    }
+    size = recv(sock, datagram, sizeof datagram, 0);
+
+    /* drop invalid, alien and outdated replies */
+    if(size != sizeof *header + sizeof *work) continue;
+    if(header->magic != req_header->magic || header->version != NS_VERSION
+        || header->type != NS_WORK_REPLY || header->job != req_header->job
+        || header->node != req_header->node || work->queue != req_work->queue
+        || work->sequence != req_work->sequence) continue;
+
+    *split = bswap_32(work->split);
+    return 0;
+  }
+}
+
+uint32_t RequestSplit(uint32_t queue, uint32_t splits, uint32_t sequence)
+{
+  char datagram[sizeof(struct NSHeader) + sizeof(struct NSWork)];
+  struct NSHeader *header = (void*)datagram;
+  struct NSWork *work = (void*)(datagram + sizeof *header);
+  int timeout = NS_TIMEOUT_MIN;
+  uint32_t split;
+
+  assert(nameservice != NULL);
+
+  if(work_sock < 0) work_sock = NameServerSocket();
+
+  /* the request has no records */
+  memset(datagram, 0, sizeof datagram);
+  header->magic = bswap_32(NS_MAGIC);
+  header->version = NS_VERSION;
+  header->type = NS_WORK;
+  header->fragments = bswap_16(1);
+  header->job = bswap_32(job);
+  header->nodes = bswap_32(nodes);
+  header->node = bswap_32(self);
+  work->queue = bswap_32(queue);
+  work->splits = bswap_32(splits);
+  work->sequence = bswap_32(sequence);
+
+  /* repeat the request until answered (or session timeout) */
+  for(;;)
+  {
+    ZLOGIF(send(work_sock, datagram, sizeof datagram, 0) != sizeof datagram,
+        "failed to send work request: %s", strerror(errno));
+    if(ReceiveSplit(work_sock, datagram, &split, timeout) == 0) break;
+
+    ZLOGS(LOG_DEBUG, "work reply missing, retry in %d ms", timeout);
+    timeout = MIN(timeout * 2, NS_TIMEOUT_MAX);
+  }
+
+  return split;
+}
+
+/* get optional job id and nodes number */
+static void SetJob()
+{
+  char *tokens[JOB_ATTRIBUTES + 1];
+  int count;
+
+  count = ParseValue(GetValueByKey(MFT_JOB), ",", tokens, JOB_ATTRIBUTES + 1);
+  ZLOGFAIL(count > JOB_ATTRIBUTES, EFAULT, "Job has invalid number of arguments");
+  job = count > 0 ? ATOI(tokens[0]) : 0;
+  nodes = count > 1 ? ATOI(tokens[1]) : 0;
 }
 
 void NameServiceCtor()
 {
   struct ChannelDesc channel = {0};
+  char *node = GetValueByKey(MFT_NODE);
+
+  self = node == NULL ? 0 : ATOI(node);
 
   netlist = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
   ZLOGFAIL(netlist == NULL, EFAULT, "cannot allocate netlist");
@@ -340,11 +613,18 @@ void NameServiceCtor()
     ZLOGFAIL(nameservice->port == 0, EFAULT, "invalid name server port");
     ZLOGFAIL(nameservice->protocol != ChannelUDP, EPROTONOSUPPORT,
         "only udp supported for name server");
+    SetJob();
   }
 }
 
 void NameServiceDtor()
 {
+  if(ns_sock >= 0) close(ns_sock);
+  ns_sock = -1;
+  if(work_sock >= 0) close(work_sock);
+  work_sock = -1;
+  g_free(parcel);
+  parcel = NULL;
   g_hash_table_destroy(netlist);
   g_free(nameservice);
   nameservice = NULL;
@@ -23,6 +23,7 @@
 #include <byteswap.h> /* for big endian conversion */
 #include <arpa/inet.h> /* convert ip <-> int */
 #include "src/channels/mount_channel.h"
+#include "src/channels/ns_protocol.h"
 
 /*
  * name server expects all data in the big endian. but on the big
@@ -60,16 +61,16 @@
 #define CONNECT_MARK 1 /* write-only channel */
 #define OUTSIDER_MARK 2 /* channel not needed name service */
 
-#define LOWEST_AVAILABLE_PORT 49152
-#define PARCEL_SIZE 65507 /* maximum size of a UDP packet */
-#define PARCEL_NODE_ID 4 /* bytes reserved for the node id */
-#define PARCEL_BINDS 4 /* bytes reserved for the binds number */
-#define PARCEL_CONNECTS 4 /* bytes reserved for the connects number */
-#define NS_PARCEL_JUNK 1 /* ending junk of the name server */
-#define PARCEL_REC_SIZE (sizeof(struct ChannelNSRecord)) /* size of the bind/connect record */
-#define PARCEL_OVERHEAD (PARCEL_NODE_ID + PARCEL_BINDS + PARCEL_CONNECTS)
-#define PARCEL_CAPACITY ((PARCEL_SIZE - PARCEL_OVERHEAD)/sizeof(struct ChannelNSRecord))
-#define NS_PARCEL_OVERHEAD PARCEL_CONNECTS + NS_PARCEL_JUNK
+/*
+ * co-located peers connect via unix socket named after the "bind" port.
+ * the sockets are placed to the private (0700) directory of the user
+ */
+#define LOCAL_CHANNEL_DIR "/tmp/zerovm-%u"
+#define LOCAL_CHANNEL_PATH LOCAL_CHANNEL_DIR "/%u"
+
+#define NS_TIMEOUT_MIN 100 /* milliseconds. the 1st retry */
+#define NS_TIMEOUT_MAX 3200 /* milliseconds. the retry interval limit */
+#define JOB_ATTRIBUTES 2
 
 /* holds connection information in the HOST order */
 struct ChannelConnection
@@ -78,24 +79,10 @@ struct ChannelConnection
   uint32_t host;
   uint16_t port;
   uint8_t mark; /* BIND_MARK, CONNECT_MARK or OUTSIDER_MARK */
+  uint8_t local; /* "bind" channel can listen (has local peer) on LOCAL_CHANNEL_PATH */
+  const char *alias; /* the channel of the record. only to report duplicates */
 };
 
-/*
- * the structure presents needful fields for name server
- * both "bind" and "connect" channels in the parcel use lists
- * containing elements of this structure
- * todo(d'b): to prevent the structure padding the pragma was used
- *   develop some more portable way (casting to array is ugly)
- */
-#pragma pack(push, 1)
-struct ChannelNSRecord
-{
-  uint32_t id; /* host id assigned by proxy */
-  uint32_t ip; /* host ip assigned by name server */
-  uint16_t port; /* host port assigned by zvm or name server */
-};
-#pragma pack(pop)
-
 /*
  * extract the channel connection information and store it into
  * the netlist hash table. on destruction all allocated memory will
@@ -106,8 +93,25 @@ void StoreChannelConnectionInfo(const struct ChannelDesc *channel);
 /* take channel connection info by channel alias */
 struct ChannelConnection *GetChannelConnectionInfo(const struct ChannelDesc *channel);
 
-/* poll the name server and update netlist with port information */
-void ResolveChannels(const struct NaClApp *nap, uint32_t binds, uint32_t connects);
+/*
+ * send the "bind" and "connect" records to the name server. does not
+ * wait for the answer, so the session can start meanwhile
+ */
+void RegisterChannels(const struct NaClApp *nap, uint32_t binds, uint32_t connects);
+
+/*
+ * wait for the name server answer to the registration (repeat it if
+ * needed) and update netlist with port information and the local flags
+ * of "bind" channels. does nothing if the channels are already resolved
+ */
+void ResolveChannels();
+
+/*
+ * ask the name server for the next split of the job work queue. the
+ * request is repeated until answered. "sequence" must grow with each
+ * new request of the queue. return the split index or NS_WORK_DONE
+ */
+uint32_t RequestSplit(uint32_t queue, uint32_t splits, uint32_t sequence);
 
 /*
  * initialize the name service table even if name service is not
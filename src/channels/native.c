@@ -0,0 +1,531 @@
+/*
+ * native network transport. length-framed stream over non-blocking
+ * tcp sockets. the data is sent from and received to the given buffer
+ * (user memory) directly without intermediate copying. each channel
+ * has own epoll instance to wait for the socket readiness
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "src/channels/name_service.h"
+#include "src/channels/native.h"
+
+static int32_t bufsize = 0; /* SO_SNDBUF / SO_RCVBUF. 0 - system default */
+static int nodelay = 1; /* TCP_NODELAY if not 0, otherwise TCP_CORK */
+
+void NativeSetOptions(int32_t size, int flag)
+{
+  ZLOGFAIL(size < 0, EFAULT, "invalid socket buffer size %d", size);
+  bufsize = size;
+  nodelay = flag;
+}
+
+/* wait until the channel socket is ready for the given events */
+static int Wait(const struct ChannelDesc *channel, uint32_t events)
+{
+  struct epoll_event ev;
+
+  ev.events = events;
+  ev.data.fd = channel->handle;
+  if(epoll_ctl(channel->poller, EPOLL_CTL_MOD, channel->handle, &ev) != 0)
+    return -1;
+
+  for(;;)
+  {
+    int code = epoll_wait(channel->poller, &ev, 1, -1);
+    if(code == 1) return 0;
+    if(code < 0 && errno != EINTR) return -1;
+  }
+}
+
+/* make the socket the channel one and watch it with the channel epoll */
+static int Attach(struct ChannelDesc *channel, int sock)
+{
+  struct epoll_event ev = {0};
+
+  ev.data.fd = sock;
+  if(epoll_ctl(channel->poller, EPOLL_CTL_ADD, sock, &ev) != 0)
+  {
+    close(sock);
+    return -1;
+  }
+
+  channel->handle = sock;
+  return 0;
+}
+
+/* open non-blocking tcp socket with the buffers set. return -1 if failed */
+static int OpenSocket()
+{
+  int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if(sock < 0 || bufsize == 0) return sock;
+
+  /* buffers must be set before listen() / connect() to affect the window */
+  if(setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof bufsize) != 0
+      || setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof bufsize) != 0)
+  {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+/*
+ * set the stream options of the connected socket. duplex channel
+ * is never corked: the peer can wait for the answer
+ */
+static void SetStreamOptions(const struct ChannelDesc *channel)
+{
+  int on = 1;
+  int code;
+
+  code = setsockopt(channel->handle, IPPROTO_TCP,
+      nodelay || channel->duplex ? TCP_NODELAY : TCP_CORK, &on, sizeof on);
+  ZLOGIF(code != 0, "cannot set stream options for %s", channel->alias);
+}
+
+/* initialize the address from the host order ip and port */
+static void MakeAddress(struct sockaddr_in *sa, uint32_t host, uint16_t port)
+{
+  memset(sa, 0, sizeof *sa);
+  sa->sin_family = AF_INET;
+  sa->sin_addr.s_addr = htonl(host);
+  sa->sin_port = htons(port);
+}
+
+int NativeChannelCtor(struct ChannelDesc *channel)
+{
+  assert(channel != NULL);
+
+  channel->handle = -1;
+  channel->frame = 0;
+  channel->sent = 0;
+  channel->ready = 0;
+  channel->listener = 0;
+  channel->cancelled = 0;
+  channel->poller = epoll_create1(EPOLL_CLOEXEC);
+  return channel->poller < 0 ? -1 : 0;
+}
+
+int NativeBind(struct ChannelDesc *channel)
+{
+  struct ChannelConnection *record;
+  struct sockaddr_in sa;
+  socklen_t size = sizeof sa;
+  int on = 1;
+  int sock;
+
+  assert(channel != NULL);
+  assert(channel->handle < 0);
+
+  record = GetChannelConnectionInfo(channel);
+  assert(record != NULL);
+
+  sock = OpenSocket();
+  if(sock < 0) return -1;
+
+  MakeAddress(&sa, INADDR_ANY, record->port);
+  if(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on) != 0
+      || bind(sock, (void*)&sa, sizeof sa) != 0
+      || listen(sock, NATIVE_LISTEN_BACKLOG) != 0
+      || getsockname(sock, (void*)&sa, &size) != 0)
+  {
+    close(sock);
+    return -1;
+  }
+
+  /* the port chosen by the kernel goes to the name server */
+  record->port = ntohs(sa.sin_port);
+  channel->listener = 1;
+
+  return Attach(channel, sock);
+}
+
+int NativeConnect(struct ChannelDesc *channel)
+{
+  int sock;
+
+  assert(channel != NULL);
+  assert(channel->handle < 0);
+
+  sock = OpenSocket();
+  if(sock < 0) return -1;
+  return Attach(channel, sock);
+}
+
+/*
+ * accept the connection on the "bind" channel (if not accepted yet)
+ * and replace the listening socket with the accepted one
+ */
+static int Accept(struct ChannelDesc *channel)
+{
+  int sock;
+
+  if(channel->ready) return 0;
+
+  do
+  {
+    if(Wait(channel, EPOLLIN) != 0) return -1;
+    sock = accept4(channel->handle, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  } while(sock < 0 && (errno == EAGAIN || errno == EINTR || errno == ECONNABORTED));
+  if(sock < 0) return -1;
+
+  /* closing also removes the listening socket from the epoll */
+  close(channel->handle);
+  if(Attach(channel, sock) != 0) return -1;
+
+  SetStreamOptions(channel);
+  channel->ready = 1;
+  return 0;
+}
+
+/*
+ * connect the "connect" channel (if not connected yet). if the peer
+ * is not listening yet, the connection is restarted with a new socket
+ * and growing pause until session timeout
+ */
+static int Establish(struct ChannelDesc *channel)
+{
+  struct ChannelConnection *record;
+  struct sockaddr_in sa;
+  useconds_t pause = NATIVE_RECONNECT_WAIT;
+
+  if(channel->ready) return 0;
+
+  record = GetChannelConnectionInfo(channel);
+  assert(record != NULL);
+  MakeAddress(&sa, record->host, record->port);
+
+  for(;;)
+  {
+    int error = 0;
+    socklen_t size = sizeof error;
+
+    if(connect(channel->handle, (void*)&sa, sizeof sa) == 0) break;
+    error = errno;
+
+    /* wait for the handshake and get the result */
+    if(error == EINPROGRESS)
+    {
+      if(Wait(channel, EPOLLOUT) != 0) return -1;
+      if(getsockopt(channel->handle, SOL_SOCKET, SO_ERROR, &error, &size) != 0)
+        return -1;
+      if(error == 0) break;
+    }
+
+    if(error != ECONNREFUSED && error != EINTR)
+    {
+      ZLOG(LOG_ERROR, "cannot connect %s: %s", channel->alias, strerror(error));
+      return -1;
+    }
+
+    /* give the peer a time to bind and restart with a new socket */
+    usleep(pause);
+    pause = MIN(pause * 2, NATIVE_RECONNECT_MAX);
+    close(channel->handle);
+    channel->handle = -1;
+    if(NativeConnect(channel) != 0) return -1;
+  }
+
+  SetStreamOptions(channel);
+  channel->ready = 1;
+  return 0;
+}
+
+/* complete the connection of the channel whatever side it is */
+static INLINE int Open(struct ChannelDesc *channel)
+{
+  return channel->listener ? Accept(channel) : Establish(channel);
+}
+
+/* receive exactly "size" bytes. return 0 if successful */
+static int Receive(struct ChannelDesc *channel, char *buf, int64_t size)
+{
+  while(size > 0)
+  {
+    ssize_t code = recv(channel->handle, buf, size, 0);
+
+    if(code > 0)
+    {
+      buf += code;
+      size -= code;
+      continue;
+    }
+
+    if(code == 0)
+    {
+      ZLOG(LOG_ERROR, "%s closed by peer before eof", channel->alias);
+      return -1;
+    }
+
+    if(errno == EINTR) continue;
+    if(errno != EAGAIN || Wait(channel, EPOLLIN) != 0) return -1;
+  }
+  return 0;
+}
+
+/* read the next frame header. on eof frame read the control digest */
+static int ReadHeader(struct ChannelDesc *channel)
+{
+  struct FrameHeader header;
+
+  if(Receive(channel, (char*)&header, sizeof header) != 0) return -1;
+  header.size = ntohl(header.size);
+  header.type = ntohl(header.type);
+
+  switch(header.type)
+  {
+    case FRAME_DATA:
+      channel->frame = header.size;
+      return 0;
+    case FRAME_EOF:
+      if(header.size >= TAG_DIGEST_SIZE) break;
+      if(Receive(channel, channel->control, header.size) != 0) return -1;
+      channel->control[header.size] = '\0';
+      channel->eof = 1;
+      return 0;
+    default:
+      break;
+  }
+
+  ZLOG(LOG_ERROR, "%s received invalid frame", channel->alias);
+  return -1;
+}
+
+int32_t NativeFetch(struct ChannelDesc *channel, char *buf, int32_t count)
+{
+  int32_t readrest;
+
+  assert(channel != NULL);
+  assert(buf != NULL);
+
+  if(Open(channel) != 0) return -1;
+
+  for(readrest = count; readrest > 0 && channel->eof == 0;)
+  {
+    int32_t toread;
+
+    /* the current frame is over, take the next one */
+    if(channel->frame == 0)
+    {
+      if(ReadHeader(channel) != 0) return -1;
+      continue;
+    }
+
+    toread = MIN(readrest, channel->frame);
+    if(Receive(channel, buf, toread) != 0) return -1;
+    channel->frame -= toread;
+    readrest -= toread;
+    buf += toread;
+  }
+
+  return count - readrest;
+}
+
+/* send whole given vector. return 0 if successful */
+static int SendVector(struct ChannelDesc *channel, struct iovec *iov, int count)
+{
+  struct msghdr msg = {0};
+
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+
+  while(msg.msg_iovlen > 0)
+  {
+    ssize_t code = sendmsg(channel->handle, &msg, MSG_NOSIGNAL);
+
+    if(code < 0)
+    {
+      if(errno == EINTR) continue;
+      if(errno != EAGAIN || Wait(channel, EPOLLOUT) != 0) return -1;
+      continue;
+    }
+
+    /* skip the sent part of the vector */
+    while(code > 0)
+    {
+      if((size_t)code < msg.msg_iov->iov_len)
+      {
+        msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + code;
+        msg.msg_iov->iov_len -= code;
+        break;
+      }
+      code -= msg.msg_iov->iov_len;
+      ++msg.msg_iov;
+      --msg.msg_iovlen;
+    }
+  }
+  return 0;
+}
+
+/*
+ * take the cancel frame sent by the reader (if any). nothing else
+ * comes upstream of the simplex channel. return not 0 if the stream
+ * is cancelled. duplex channel upstream is the data, it is never cancelled
+ */
+static int Cancelled(struct ChannelDesc *channel)
+{
+  struct FrameHeader header;
+
+  if(channel->cancelled) return 1;
+  if(channel->duplex) return 0;
+
+  /* the header is peeked first: a partial one is left in the socket */
+  channel->sent = 0;
+  if(recv(channel->handle, &header, sizeof header, MSG_DONTWAIT | MSG_PEEK)
+      != sizeof header) return 0;
+  if(recv(channel->handle, &header, sizeof header, MSG_DONTWAIT) == sizeof header
+      && ntohl(header.type) == FRAME_CANCEL)
+  {
+    ZLOGS(LOG_DEBUG, "%s cancelled by the reader after %ld bytes",
+        channel->alias, channel->counters[PutSizeLimit]);
+    channel->cancelled = 1;
+  }
+  return channel->cancelled;
+}
+
+/* send the frame. the header and the payload go with one syscall */
+static int32_t SendFrame(struct ChannelDesc *channel,
+    uint32_t type, const char *buf, int32_t count)
+{
+  struct FrameHeader header;
+  struct iovec iov[2];
+
+  header.size = htonl(count);
+  header.type = htonl(type);
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof header;
+  iov[1].iov_base = (void*)buf;
+  iov[1].iov_len = count;
+
+  if(SendVector(channel, iov, 2) != 0)
+  {
+    /* the reader closed the connection right after the cancel */
+    if((errno == ECONNRESET || errno == EPIPE) && Cancelled(channel))
+      return -1;
+    ZLOG(LOG_ERROR, "cannot send to %s: %s", channel->alias, strerror(errno));
+    return -1;
+  }
+  return count;
+}
+
+int32_t NativeSend(struct ChannelDesc *channel, const char *buf, int32_t count)
+{
+  assert(channel != NULL);
+  assert(buf != NULL);
+
+  if(Open(channel) != 0) return -1;
+
+  /* look for the cancel from time to time */
+  channel->sent += count;
+  if(channel->sent >= NATIVE_CANCEL_CHECK || channel->cancelled)
+  {
+    if(Cancelled(channel))
+    {
+      errno = EPIPE;
+      return -1;
+    }
+  }
+
+  return SendFrame(channel, FRAME_DATA, buf, count);
+}
+
+int32_t NativeBroadcast(struct ChannelDesc *channel, const char *buf, int32_t count)
+{
+  int alive = 0;
+  int i;
+
+  assert(channel != NULL);
+  assert(channel->peers != NULL);
+
+  for(i = 0; i < channel->peers_count; ++i)
+  {
+    struct ChannelDesc *peer = &channel->peers[i];
+
+    if(peer->cancelled) continue;
+    if(NativeSend(peer, buf, count) != count)
+    {
+      /* the cancelled subscriber is dropped, the rest keep going */
+      if(!peer->cancelled) return -1;
+      continue;
+    }
+
+    peer->counters[PutSizeLimit] += count;
+    ++alive;
+  }
+
+  if(alive > 0) return count;
+  channel->cancelled = 1;
+  errno = EPIPE;
+  return -1;
+}
+
+int NativeSendEOF(struct ChannelDesc *channel, const char *digest, int32_t size)
+{
+  int off = 0;
+
+  assert(channel != NULL);
+  assert(digest != NULL);
+
+  if(Open(channel) != 0) return -1;
+
+  /* the reader could cancel the rest of the stream */
+  if(Cancelled(channel))
+  {
+    errno = EPIPE;
+    return -1;
+  }
+
+  if(SendFrame(channel, FRAME_EOF, digest, size) < 0) return -1;
+
+  /* flush the corked stream and notify the peer */
+  if(!nodelay && !channel->duplex)
+    setsockopt(channel->handle, IPPROTO_TCP, TCP_CORK, &off, sizeof off);
+  shutdown(channel->handle, SHUT_WR);
+  return 0;
+}
+
+void NativeCancel(struct ChannelDesc *channel)
+{
+  struct FrameHeader header;
+  struct iovec iov;
+
+  assert(channel != NULL);
+
+  if(Open(channel) != 0) return;
+
+  header.size = 0;
+  header.type = htonl(FRAME_CANCEL);
+  iov.iov_base = &header;
+  iov.iov_len = sizeof header;
+  if(SendVector(channel, &iov, 1) == 0) channel->cancelled = 1;
+}
+
+void NativeChannelDtor(struct ChannelDesc *channel)
+{
+  assert(channel != NULL);
+
+  if(channel->handle >= 0) close(channel->handle);
+  if(channel->poller >= 0) close(channel->poller);
+  channel->handle = -1;
+  channel->poller = -1;
+}
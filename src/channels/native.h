@@ -0,0 +1,115 @@
+/*
+ * native network transport api
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NATIVE_H_
+#define NATIVE_H_
+
+#include "src/channels/mount_channel.h"
+
+/*
+ * the stream consists of frames. each frame starts with the header
+ * (both fields in the network order) followed by "size" bytes of payload.
+ * the last frame of the stream is FRAME_EOF, its payload is the etag
+ * digest of the sent data (empty if etag disabled). the reader which
+ * stops before eof sends FRAME_CANCEL (no payload) back to the writer.
+ * the duplex channel carries two streams (one in each direction) over
+ * the same connection and has no FRAME_CANCEL
+ */
+#define FRAME_DATA 0
+#define FRAME_EOF 1
+#define FRAME_CANCEL 2
+
+#define NATIVE_CANCEL_CHECK 0x40000 /* the writer looks for the cancel every 256kb */
+#define NATIVE_LISTEN_BACKLOG 16
+#define NATIVE_RECONNECT_WAIT 1000 /* 1 millisecond */
+#define NATIVE_RECONNECT_MAX 0x40000 /* ~1/4 second */
+
+struct FrameHeader
+{
+  uint32_t size; /* payload size */
+  uint32_t type; /* FRAME_DATA or FRAME_EOF */
+};
+
+/*
+ * set socket options for all native channels:
+ * bufsize - SO_SNDBUF / SO_RCVBUF in bytes, 0 to keep system default
+ * nodelay - if not 0 use TCP_NODELAY, otherwise cork the stream
+ *   until the end of the data (TCP_CORK)
+ */
+void NativeSetOptions(int32_t bufsize, int nodelay);
+
+/*
+ * initialize native fields of the channel. should be called
+ * before bind/connect. return 0 if successful
+ */
+int NativeChannelCtor(struct ChannelDesc *channel);
+
+/*
+ * open the socket and bind it to the address from the netlist
+ * record. if the record has no port the kernel chooses it and
+ * the port is stored to the record. return not 0 if failed
+ */
+int NativeBind(struct ChannelDesc *channel);
+
+/*
+ * open the socket for the connection to the address from the
+ * netlist record. the connection will be established (and
+ * restarted if refused) on the first send. return not 0 if failed
+ */
+int NativeConnect(struct ChannelDesc *channel);
+
+/*
+ * fetch the data from the native channel. blocks until "count"
+ * bytes received or eof reached. return number of received bytes
+ * or -1 if failed. on eof the channel control digest is updated
+ */
+int32_t NativeFetch(struct ChannelDesc *channel, char *buf, int32_t count);
+
+/*
+ * send the data as a single frame. return number of sent bytes
+ * or -1 if failed. if the reader cancelled the stream the channel
+ * "cancelled" is set
+ */
+int32_t NativeSend(struct ChannelDesc *channel, const char *buf, int32_t count);
+
+/*
+ * send the data to all not cancelled subscribers of the broadcast
+ * channel (the "peers"). the slowest subscriber paces the writer.
+ * return number of sent bytes or -1 if failed. if all subscribers
+ * cancelled the stream the channel "cancelled" is set
+ */
+int32_t NativeBroadcast(struct ChannelDesc *channel, const char *buf, int32_t count);
+
+/*
+ * send FRAME_EOF with the given digest and shut the sending side
+ * of the stream down. the receiving side of the duplex channel
+ * stays open. return 0 if successful
+ */
+int NativeSendEOF(struct ChannelDesc *channel, const char *digest, int32_t size);
+
+/*
+ * tell the writer that the reader will not take the rest of the
+ * stream. the writer stops sending on its next cancel check
+ * note: the duplex channel cannot be cancelled
+ */
+void NativeCancel(struct ChannelDesc *channel);
+
+/* close the channel sockets */
+void NativeChannelDtor(struct ChannelDesc *channel);
+
+#endif /* NATIVE_H_ */
@@ -0,0 +1,102 @@
+/*
+ * name service protocol (v2) shared by zerovm and the name server
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NS_PROTOCOL_H_
+#define NS_PROTOCOL_H_
+
+#include <stdint.h>
+
+/*
+ * the "bind" record of the request: the channel can listen on the local
+ * endpoint. the reply: the peer runs on the same host (and the binder
+ * listens on the local endpoint)
+ */
+#define NS_LOCAL_FLAG 1
+
+/*
+ * name service protocol v2. the parcel (node records) is split to the
+ * fragments, each fragment is sent as a separate datagram with its own
+ * header. the request is re-sent with exponentially growing timeout
+ * until all reply fragments received. the name server must answer the
+ * repeated request of the resolved node with the same reply
+ */
+#define NS_MAGIC 0x5a564e53 /* "ZVNS" */
+#define NS_VERSION 2
+#define NS_REQUEST 1
+#define NS_REPLY 2
+#define NS_WORK 3 /* the work queue split request */
+#define NS_WORK_REPLY 4
+#define NS_WORK_DONE 0xffffffff /* the work queue has no splits left */
+#define NS_DATAGRAM_SIZE 1400 /* fits ethernet mtu to avoid ip fragmentation */
+#define NS_FRAGMENT_RECORDS \
+  ((NS_DATAGRAM_SIZE - sizeof(struct NSHeader)) / PARCEL_REC_SIZE)
+#define NS_FRAGMENTS_MAX 0xffff
+#define NS_MAX_RECORDS (NS_FRAGMENTS_MAX * NS_FRAGMENT_RECORDS) /* binds + connects */
+#define PARCEL_REC_SIZE (sizeof(struct ChannelNSRecord)) /* size of the bind/connect record */
+
+/*
+ * the structure presents needful fields for name server
+ * both "bind" and "connect" channels in the parcel use lists
+ * containing elements of this structure
+ * todo(d'b): to prevent the structure padding the pragma was used
+ *   develop some more portable way (casting to array is ugly)
+ */
+#pragma pack(push, 1)
+struct ChannelNSRecord
+{
+  uint32_t id; /* host id assigned by proxy */
+  uint32_t ip; /* host ip assigned by name server */
+  uint16_t port; /* host port assigned by zvm or name server */
+  uint8_t flags; /* NS_LOCAL_FLAG */
+};
+
+/*
+ * the datagram header. request and reply fragments carry "bind" records
+ * followed by "connect" records (resolved in the reply). the fragment
+ * records start from "fragment * NS_FRAGMENT_RECORDS"
+ */
+struct NSHeader
+{
+  uint32_t magic; /* NS_MAGIC */
+  uint8_t version; /* NS_VERSION */
+  uint8_t type; /* NS_REQUEST or NS_REPLY */
+  uint16_t fragment; /* the fragment index */
+  uint16_t fragments; /* the fragments number */
+  uint16_t reserved; /* zero */
+  uint32_t job; /* job id. 0 if not specified */
+  uint32_t nodes; /* job nodes number. 0 - name server default */
+  uint32_t node; /* the node id */
+  uint32_t binds; /* the node "bind" records number */
+  uint32_t connects; /* the node "connect" records number */
+};
+
+/*
+ * the work queue datagram body (after the header). the node asks for
+ * the next split of the job queue, the name server answers with the
+ * split index. the repeated request (same sequence) gets the same answer
+ */
+struct NSWork
+{
+  uint32_t queue; /* the queue id */
+  uint32_t splits; /* the queue splits number */
+  uint32_t sequence; /* the node request number, starts from 1 */
+  uint32_t split; /* zero in the request, the split index in the reply */
+};
+#pragma pack(pop)
+
+#endif /* NS_PROTOCOL_H_ */
@@ -0,0 +1,289 @@
+/*
+ * partition (shuffle) network channel. the record goes to the
+ * subscriber number fnv1a64(key) % subscribers, so all writers of the
+ * job route the same key to the same subscriber. the records are
+ * collected in the per subscriber buffer and sent as one frame when
+ * the buffer is full (or the channel is closed), so the user program
+ * can write the whole bunch of records with one call
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include "src/main/manifest_parser.h"
+#include "src/main/manifest_setup.h"
+#include "src/main/etag.h"
+#include "src/channels/native.h"
+#include "src/channels/partition.h"
+#include "src/channels/record.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325LLU
+#define FNV_PRIME 0x100000001b3LLU
+
+struct Batch
+{
+  char *buffer;
+  int32_t used;
+};
+
+struct Partition
+{
+  int32_t record; /* fixed record size. 0 - records have the length prefix */
+  int32_t offset; /* key offset in the record (after the prefix) */
+  int32_t size; /* key size */
+  char *carry; /* incomplete record taken from the previous calls */
+  int32_t carried;
+  int32_t capacity;
+  struct Batch *batches; /* one per subscriber */
+};
+
+static uint64_t Hash(const char *key, int32_t size)
+{
+  uint64_t hash = FNV_OFFSET;
+  int32_t i;
+
+  for(i = 0; i < size; ++i)
+  {
+    hash ^= (uint8_t)key[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+/*
+ * return the size of the record starting at "buf" or -1 if the
+ * length prefix is not complete yet. invalid size returns 0
+ */
+static int64_t RecordSize(const struct Partition *p, const char *buf, int32_t count)
+{
+  return p->record > 0 ? p->record : PrefixedRecordSize(buf, count);
+}
+
+/* send the data to the subscriber. the cancelled subscriber is skipped */
+static int SendPeer(struct ChannelDesc *peer, const char *buf, int32_t count)
+{
+  if(peer->cancelled || count == 0) return 0;
+
+  if(NativeSend(peer, buf, count) != count)
+    return peer->cancelled ? 0 : -1;
+
+  if(peer->tag != NULL) TagUpdate(peer->tag, buf, count);
+  peer->counters[PutSizeLimit] += count;
+  return 0;
+}
+
+/* send the subscriber batch. return 0 if successful */
+static int Flush(struct ChannelDesc *channel, int i)
+{
+  struct Partition *p = channel->partition;
+  int result = SendPeer(&channel->peers[i], p->batches[i].buffer, p->batches[i].used);
+
+  p->batches[i].used = 0;
+  return result;
+}
+
+/* put the complete record to the subscriber batch. return 0 if successful */
+static int Route(struct ChannelDesc *channel, const char *record, int32_t size)
+{
+  struct Partition *p = channel->partition;
+  const char *payload = record;
+  int32_t length = size;
+  struct Batch *batch;
+  int i;
+
+  /* the key is cut by the record end */
+  if(p->record == 0)
+  {
+    payload += RECORD_PREFIX_SIZE;
+    length -= RECORD_PREFIX_SIZE;
+  }
+  length = MAX(0, MIN(length - p->offset, p->size));
+  i = Hash(payload + p->offset, length) % channel->peers_count;
+  batch = &p->batches[i];
+
+  if(batch->used + size > PARTITION_BATCH_SIZE && Flush(channel, i) != 0)
+    return -1;
+
+  /* the big record goes straight */
+  if(size > PARTITION_BATCH_SIZE)
+    return SendPeer(&channel->peers[i], record, size);
+
+  memcpy(batch->buffer + batch->used, record, size);
+  batch->used += size;
+  return 0;
+}
+
+/* append the data to the incomplete record */
+static void Carry(struct Partition *p, const char *buf, int32_t count)
+{
+  if(p->carried + count > p->capacity)
+  {
+    p->capacity = MAX(p->carried + count, 2 * p->capacity);
+    p->carry = g_realloc(p->carry, p->capacity);
+  }
+  memcpy(p->carry + p->carried, buf, count);
+  p->carried += count;
+}
+
+int32_t PartitionSend(struct ChannelDesc *channel, const char *buf, int32_t count)
+{
+  struct Partition *p;
+  int32_t rest;
+  int i;
+
+  assert(channel != NULL);
+  assert(channel->partition != NULL);
+  assert(buf != NULL);
+
+  p = channel->partition;
+  for(rest = count; rest > 0;)
+  {
+    int64_t size;
+
+    /* complete the incomplete record first */
+    if(p->carried > 0)
+    {
+      int64_t take;
+
+      size = RecordSize(p, p->carry, p->carried);
+      if(size == 0) break;
+      take = MIN(rest, (size < 0 ? RECORD_PREFIX_SIZE : size) - p->carried);
+      Carry(p, buf, take);
+      buf += take;
+      rest -= take;
+
+      if(size > 0 && p->carried == size)
+      {
+        p->carried = 0;
+        if(Route(channel, p->carry, size) != 0) return -1;
+      }
+      continue;
+    }
+
+    /* take the complete records right from the user buffer */
+    size = RecordSize(p, buf, rest);
+    if(size == 0) break;
+    if(size < 0 || size > rest)
+    {
+      Carry(p, buf, rest);
+      rest = 0;
+      break;
+    }
+
+    if(Route(channel, buf, size) != 0) return -1;
+    buf += size;
+    rest -= size;
+  }
+
+  if(rest > 0)
+  {
+    ZLOG(LOG_ERROR, "%s got the record of invalid size", channel->alias);
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* the stream has no readers anymore */
+  for(i = 0; i < channel->peers_count; ++i)
+    if(!channel->peers[i].cancelled) return count;
+  channel->cancelled = 1;
+  errno = EPIPE;
+  return -1;
+}
+
+/* parse the "Partition" value of the channel. return 0 if there is none */
+static int ParsePartition(const struct ChannelDesc *channel,
+    char *value, struct Partition *p)
+{
+  char *tokens[PARTITION_ATTRIBUTES + 1];
+  int count;
+
+  count = ParseValue(value, ",", tokens, PARTITION_ATTRIBUTES + 1);
+  if(count == 0) return 0;
+
+  ZLOGFAIL(count != PARTITION_ATTRIBUTES, EFAULT,
+      "Partition has invalid number of arguments");
+  p->record = ATOI(tokens[1]);
+  p->offset = ATOI(tokens[2]);
+  p->size = ATOI(tokens[3]);
+  ZLOGFAIL(p->record < 0 || p->record > RECORD_MAX, EFAULT,
+      "%s has invalid record size", channel->alias);
+  ZLOGFAIL(p->offset < 0 || p->size <= 0, EFAULT,
+      "%s has invalid key", channel->alias);
+  ZLOGFAIL(p->record > 0 && p->offset + p->size > p->record, EFAULT,
+      "%s key is out of the record", channel->alias);
+  return 1;
+}
+
+void PartitionCtor(struct ChannelDesc *channel)
+{
+  struct Partition partition = {0};
+  struct Partition *p;
+  int i;
+
+  assert(channel != NULL);
+  assert(channel->peers != NULL);
+
+  channel->partition = NULL;
+  if(!ParsePartition(channel, GetValueByAlias(MFT_PARTITION, channel->alias), &partition))
+    return;
+
+  p = g_memdup(&partition, sizeof partition);
+  p->batches = g_malloc0(channel->peers_count * sizeof *p->batches);
+  for(i = 0; i < channel->peers_count; ++i)
+  {
+    p->batches[i].buffer = g_malloc(PARTITION_BATCH_SIZE);
+
+    /* each subscriber gets the digest of own part of the stream */
+    if(channel->tag != NULL)
+      channel->peers[i].tag = TagCtor();
+  }
+
+  channel->partition = p;
+  ZLOGS(LOG_DEBUG, "%s partitions records of %d bytes by key %d:%d",
+      channel->alias, p->record, p->offset, p->size);
+}
+
+void PartitionDtor(struct ChannelDesc *channel)
+{
+  struct Partition *p;
+  int i;
+
+  assert(channel != NULL);
+
+  p = channel->partition;
+  if(p == NULL) return;
+
+  ZLOGIF(p->carried > 0, "%s closed with incomplete record", channel->alias);
+  for(i = 0; i < channel->peers_count; ++i)
+  {
+    struct ChannelDesc *peer = &channel->peers[i];
+
+    if(Flush(channel, i) != 0)
+      ZLOG(LOG_ERROR, "cannot send to %s", peer->name);
+    g_free(p->batches[i].buffer);
+
+    if(peer->tag != NULL)
+    {
+      TagDigest(peer->tag, peer->digest);
+      TagDtor(peer->tag);
+      peer->tag = NULL;
+    }
+  }
+
+  g_free(p->batches);
+  g_free(p->carry);
+  g_free(p);
+  channel->partition = NULL;
+}
@@ -0,0 +1,50 @@
+/*
+ * partition (shuffle) network channel. the user writes the record
+ * stream, the records are routed by the key hash to the broadcast
+ * channel subscribers and sent in batches
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PARTITION_H_
+#define PARTITION_H_
+
+#include "src/channels/mount_channel.h"
+
+#define PARTITION_ATTRIBUTES 4 /* alias, record size, key offset, key size */
+#define PARTITION_BATCH_SIZE 0x10000 /* each destination buffer */
+
+/*
+ * make the broadcast channel the partition one if the manifest has
+ * "Partition" key for its alias. should be called after the channel
+ * subscribers ("peers") are constructed
+ */
+void PartitionCtor(struct ChannelDesc *channel);
+
+/*
+ * take the next part of the record stream and route the complete
+ * records to the subscribers. the records can span the calls. return
+ * "count" or -1 if failed. if all subscribers cancelled the stream
+ * the channel "cancelled" is set
+ */
+int32_t PartitionSend(struct ChannelDesc *channel, const char *buf, int32_t count);
+
+/*
+ * send the batched records and release the partition. the subscribers
+ * digests are ready after it. the eof is not sent
+ */
+void PartitionDtor(struct ChannelDesc *channel);
+
+#endif /* PARTITION_H_ */
@@ -1,6 +1,6 @@
 /*
  * preallocate network channel
- * note: made over zeromq library
+ * note: made over zeromq library or native transport (see native.c)
  *
  * Copyright (c) 2012, LiteStack, Inc.
  *
@@ -25,17 +25,40 @@
 #include "src/main/etag.h"
 #include "src/main/nacl_globals.h" /* todo(d'b): remove it. (gnap) */
 #include "src/channels/name_service.h"
+#include "src/channels/native.h"
+#include "src/channels/partition.h"
 
 static uint32_t channels_cnt = 0; /* needs for NetCtor/Dtor */
 static void *context = NULL; /* zeromq context */
+static enum ChannelTransport transport = TransportZMQ;
 static uint32_t binds = 0; /* "bind" channels number */
 static uint32_t connects = 0; /* "connect" channels number */
+static GPtrArray *netchannels = NULL; /* all constructed network channels */
+static int unconnected = 0; /* registered but not connected yet (lazy mode) */
+
+/*
+ * make the local endpoint path of the given port. the private directory
+ * of the user is created if needed, the existing one must be private
+ */
+static void LocalPath(char *path, int32_t size, uint16_t port)
+{
+  char dir[BIG_ENOUGH_STRING];
+  struct stat fs;
+
+  g_snprintf(dir, BIG_ENOUGH_STRING, LOCAL_CHANNEL_DIR, getuid());
+  if(mkdir(dir, S_IRWXU) != 0)
+    ZLOGFAIL(errno != EEXIST || lstat(dir, &fs) != 0 || !S_ISDIR(fs.st_mode)
+        || fs.st_uid != getuid() || (fs.st_mode & (S_IRWXG | S_IRWXO)) != 0,
+        EACCES, "%s is not a private directory", dir);
+  g_snprintf(path, size, LOCAL_CHANNEL_PATH, getuid(), port);
+}
 
 /* make url from the given record and return it through the "url" parameter */
 static void MakeURL(char *url, int32_t size,
     const struct ChannelDesc *channel, const struct ChannelConnection *record)
 {
   char host[BIG_ENOUGH_STRING];
+  char path[BIG_ENOUGH_STRING];
 
   assert(url != NULL);
   assert(record != NULL);
@@ -46,6 +69,15 @@ static void MakeURL(char *url, int32_t size,
       EFAULT, "named hosts are not supported");
   ZLOGFAIL(size < 6, EFAULT, "too short url buffer");
 
+  /* local endpoint has the path instead of the host */
+  if(record->protocol == ChannelIPC)
+  {
+    LocalPath(path, BIG_ENOUGH_STRING, record->port);
+    g_snprintf(url, size, "ipc://%s", path);
+    ZLOG(LOG_INSANE, "url = %s", url);
+    return;
+  }
+
   /* create string containing ip or id as the host name */
   switch(record->mark)
   {
@@ -71,71 +103,143 @@ static void MakeURL(char *url, int32_t size,
 }
 
 /*
- * bind the given channel using info from netlist
+ * bind zmq socket to the port chosen by the kernel and store the port
+ * to the channel record. returns not 0 if failed
+ * note: zmq 2.x cannot report the bound port, so the port is reserved
+ *   by the probe socket. the probe is not listening and both sockets
+ *   use SO_REUSEADDR, so zmq can listen on the same port
+ */
+static int BindAnyPort(const struct ChannelDesc *channel,
+    struct ChannelConnection *record)
+{
+  char url[BIG_ENOUGH_STRING];
+#ifdef ZMQ_LAST_ENDPOINT
+  size_t size = sizeof url;
+  char *port;
+
+  if(zmq_bind(channel->socket, "tcp://*:0") != 0) return -1;
+  if(zmq_getsockopt(channel->socket, ZMQ_LAST_ENDPOINT, url, &size) != 0)
+    return -1;
+  port = strrchr(url, ':');
+  record->port = port == NULL ? 0 : ATOI(port + 1);
+  return record->port == 0 ? -1 : 0;
+#else
+  struct sockaddr_in sa;
+  socklen_t size = sizeof sa;
+  int on = 1;
+  int probe;
+  int result = -1;
+
+  probe = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(probe < 0) return -1;
+
+  memset(&sa, 0, sizeof sa);
+  sa.sin_family = AF_INET;
+  if(setsockopt(probe, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on) == 0
+      && bind(probe, (void*)&sa, sizeof sa) == 0
+      && getsockname(probe, (void*)&sa, &size) == 0)
+  {
+    record->port = bswap_16(sa.sin_port);
+    g_snprintf(url, BIG_ENOUGH_STRING, "tcp://*:%u", record->port);
+    result = zmq_bind(channel->socket, url);
+  }
+
+  close(probe);
+  return result;
+#endif
+}
+
+/*
+ * bind the given channel using info from netlist. the channel without
+ * port gets the port chosen by the kernel (stored to netlist)
  * returns not 0 if failed
- * note: replaces PrepareBind if no name service available
  */
 static int DoBind(const struct ChannelDesc* channel)
 {
   struct ChannelConnection *record;
   char buf[BIG_ENOUGH_STRING], *url = buf;
+  int result;
 
   record = GetChannelConnectionInfo(channel);
   assert(record != NULL);
 
-  MakeURL(url, BIG_ENOUGH_STRING, channel, record);
+  if(channel->transport == TransportNative)
+    return NativeBind((struct ChannelDesc*)channel);
+
+  if(record->port == 0)
+    result = BindAnyPort(channel, record);
+  else
+  {
+    MakeURL(url, BIG_ENOUGH_STRING, channel, record);
+    result = zmq_bind(channel->socket, url);
+  }
+
+  if(result == 0)
+    ZLOGS(LOG_DEBUG, "%s bound to port %u", channel->alias, record->port);
+  return result;
+}
+
+/*
+ * the name server switched the co-located peer of "bind" channel to
+ * the local endpoint. listen on it as well
+ */
+static void BindLocal(const struct ChannelDesc *channel,
+    const struct ChannelConnection *record)
+{
+  char path[BIG_ENOUGH_STRING];
+  char url[BIG_ENOUGH_STRING];
+
+  LocalPath(path, BIG_ENOUGH_STRING, record->port);
+  g_snprintf(url, BIG_ENOUGH_STRING, "ipc://%s", path);
   ZLOGS(LOG_DEBUG, "bind url %s", url);
-  return zmq_bind(channel->socket, url);
+  ZLOGFAIL(zmq_bind(channel->socket, url) != 0, EFAULT,
+      "cannot bind %s to %s", channel->alias, url);
 }
 
 /*
- * prepare "bind" channel information for the name service
- * note: should be called before name service invocation
+ * prepare "bind" channel (the netlist record is already stored)
+ * note: with the name service the channels are bound by BindChannels()
  */
 static void PrepareBind(const struct ChannelDesc *channel)
 {
-  struct ChannelConnection *record;
-  static uint16_t port = LOWEST_AVAILABLE_PORT;
-  int result = 1;
-
   assert(channel != NULL);
 
-  /* update netlist with the connection info */
-  StoreChannelConnectionInfo(channel);
-
   /* if no name service is available just use given url and return */
   if(!NameServiceSet())
-  {
-    result = DoBind(channel);
-    ZLOGFAIL(result != 0, EFAULT, "cannot bind %s", channel->alias);
-    return;
-  }
+    ZLOGFAIL(DoBind(channel) != 0, EFAULT, "cannot bind %s", channel->alias);
+}
 
-  record = GetChannelConnectionInfo(channel);
-  assert(record != NULL);
+/*
+ * return not 0 if the channel accepts the connection: readable simplex
+ * channel or duplex channel which got "bind" role by the node ids
+ */
+static int IsBinder(const struct ChannelDesc *channel)
+{
+  if(channel->duplex)
+    return GetChannelConnectionInfo(channel)->mark == BIND_MARK;
+  return channel->limits[GetsLimit] && channel->limits[GetSizeLimit];
+}
 
-  /* in case channel has port assigned (full url) bind it and return */
-  if(record->port != 0)
-  {
-    result = DoBind(channel);
-    ZLOGFAIL(result != 0, EFAULT, "cannot bind %s", channel->alias);
-    return;
-  }
+/*
+ * bind all network "bind" channels at once right before the
+ * registration. the ports are chosen by the kernel, so each channel
+ * takes exactly one bind. zmq channels can also listen on the local
+ * endpoint (bound when the name server reports the local peer)
+ */
+static void BindChannels()
+{
+  guint i;
 
-  /*
-   * if channel does not have port pick up the port in the loop
-   * todo(d'b): check upcoming zmq version for port 0 binding
-   */
-  assert(record != NULL);
-  for(;port >= LOWEST_AVAILABLE_PORT; ++port)
+  for(i = 0; i < netchannels->len; ++i)
   {
-    record->port = port;
-    result = DoBind(channel);
-    if(result == 0) break;
-  }
+    struct ChannelDesc *channel = g_ptr_array_index(netchannels, i);
+
+    /* only the "bind" network channels are bound */
+    if(channel->peers != NULL || !IsBinder(channel)) continue;
 
-  ZLOGFAIL(result != 0, EFAULT ,"cannot get port to bind %s", channel->alias);
-  ZLOGS(LOG_DEBUG, "host = %u, port = %u", record->host, record->port);
+    ZLOGFAIL(DoBind(channel) != 0, EFAULT, "cannot bind %s", channel->alias);
+    GetChannelConnectionInfo(channel)->local = channel->transport == TransportZMQ;
+  }
 }
 
 /*
@@ -153,63 +257,78 @@ static int DoConnect(struct ChannelDesc* channel)
 
   MakeURL(url, BIG_ENOUGH_STRING, channel, record);
   ZLOGS(LOG_DEBUG, "connect url %s", url);
+  if(channel->transport == TransportNative)
+    return NativeConnect(channel);
   return zmq_connect(channel->socket, url);
 }
 
 /*
- * prepare "connect" channel information for the name service
+ * prepare "connect" channel (the netlist record is already stored)
  * note: will be called before name service invocation
  */
 static void PrepareConnect(struct ChannelDesc* channel)
 {
   assert(channel != NULL);
 
-  /* update netlist with the connection info */
-  StoreChannelConnectionInfo(channel);
-
   /* if no name service is available just use given url and return */
   if(!NameServiceSet())
   {
     int result;
     uint64_t hwm = 1; /* high water mark for PUSH socket to block on sending */
 
-    result = zmq_setsockopt(channel->socket, ZMQ_HWM, &hwm, sizeof hwm);
-    ZLOGFAIL(result != 0, EFAULT, "cannot set high water mark");
+    /* native transport blocks on sending by design */
+    if(channel->transport == TransportZMQ)
+    {
+      result = zmq_setsockopt(channel->socket, ZMQ_HWM, &hwm, sizeof hwm);
+      ZLOGFAIL(result != 0, EFAULT, "cannot set high water mark");
+    }
 
     result = DoConnect(channel);
     ZLOGFAIL(result != 0, EFAULT, "cannot connect %s", channel->alias);
   }
 }
 
-void KickPrefetchChannels(const struct NaClApp *nap)
+/*
+ * get the name server answer and connect all network "connect"
+ * channels. does nothing if the channels are already connected
+ */
+static void ConnectChannels()
 {
-  int i;
-
-  /* quietly return if no name service specified */
-  if(!NameServiceSet()) return;
+  guint i;
 
-  assert(nap != NULL);
-  assert(nap->system_manifest != NULL);
+  if(!unconnected) return;
 
-  /* exchange channel information with the name server */
-  ResolveChannels(nap, binds, connects);
+  /* get the answer from the name server */
+  ResolveChannels();
 
   /* make connections */
-  for(i = 0; i < nap->system_manifest->channels_count; ++i)
+  for(i = 0; i < netchannels->len; ++i)
   {
     int result;
-    struct ChannelDesc *channel = &nap->system_manifest->channels[i];
+    struct ChannelDesc *channel = g_ptr_array_index(netchannels, i);
     struct ChannelConnection *record;
 
     assert(channel != NULL);
 
-    /* skip all channels except the network "connect" ones */
-    if(channel->source != ChannelTCP) continue;
+    /* broadcast channel connects all its subscribers */
+    if(channel->peers != NULL)
+    {
+      int j;
+      for(j = 0; j < channel->peers_count; ++j)
+        ZLOGFAIL(DoConnect(&channel->peers[j]) != 0, EFAULT,
+            "cannot connect socket to %s", channel->peers[j].name);
+      continue;
+    }
 
     /* get the channel connection information */
     record = GetChannelConnectionInfo(channel);
     assert(record != NULL);
 
+    /* "bind" channel with the local peer listens on the local endpoint */
+    if(record->mark == BIND_MARK && record->local
+        && channel->transport == TransportZMQ)
+      BindLocal(channel, record);
+
     /* only the "connect" channels need to be processed */
     if(record->mark != CONNECT_MARK) continue;
 
@@ -217,13 +336,51 @@ void KickPrefetchChannels(const struct NaClApp *nap)
     result = DoConnect(channel);
     ZLOGFAIL(result != 0, EFAULT, "cannot connect socket to %s", channel->alias);
   }
+  unconnected = 0;
 
   /*
    * temporary fix (the lost 1st messsage) to allow 0mq to complete
    * the connection procedure. 1 millisecond should be enough
    * todo(d'b): replace it with the channels readiness check
+   * note: native transport completes the connection itself
+   */
+  if(transport == TransportZMQ) usleep(PREPOLL_WAIT);
+}
+
+/* get the connection mode: "Connect = eager" (default) or "lazy" */
+static int IsLazy()
+{
+  char *value = GetValueByKey(MFT_CONNECT);
+
+  if(value == NULL || g_strcmp0(value, "eager") == 0) return 0;
+  ZLOGFAIL(g_strcmp0(value, "lazy") != 0, EFAULT, "invalid Connect value %s", value);
+  return 1;
+}
+
+void KickPrefetchChannels(const struct NaClApp *nap)
+{
+  /* quietly return if no name service specified */
+  if(!NameServiceSet()) return;
+
+  assert(nap != NULL);
+  assert(nap->system_manifest != NULL);
+
+  /* bind all channels and send channel information to the name server */
+  BindChannels();
+  RegisterChannels(nap, binds, connects);
+  unconnected = 1;
+
+  /*
+   * in the lazy mode the session starts right away, the answer will
+   * be taken on the 1st network channel access
    */
-  usleep(PREPOLL_WAIT);
+  if(IsLazy())
+  {
+    ZLOGS(LOG_DEBUG, "network channels will be connected lazily");
+    return;
+  }
+
+  ConnectChannels();
 }
 
 /*
@@ -257,6 +414,38 @@ enum ChannelSourceType GetChannelProtocol(const char *url)
 }
 #undef CHECK_TRANSPORT
 
+/*
+ * get network transport and its options from the manifest:
+ * "Transport = name[, buffer size[, nodelay]]"
+ * note: options are only used by the native transport
+ */
+static void SetTransport()
+{
+  char *names[] = CHANNEL_TRANSPORT_NAMES;
+  char *tokens[TRANSPORT_ATTRIBUTES + 1];
+  int32_t bufsize = 0;
+  int nodelay = 1;
+  int count;
+
+  count = ParseValue(GetValueByKey(MFT_TRANSPORT), ",",
+      tokens, TRANSPORT_ATTRIBUTES + 1);
+  if(count == 0) return;
+  ZLOGFAIL(count > TRANSPORT_ATTRIBUTES, EFAULT,
+      "Transport has invalid number of arguments");
+
+  for(transport = 0; transport < ChannelTransportNumber; ++transport)
+    if(g_strcmp0(tokens[0], names[transport]) == 0) break;
+  ZLOGFAIL(transport == ChannelTransportNumber, EFAULT,
+      "unknown transport %s", tokens[0]);
+
+  if(count > 1) bufsize = ATOI(tokens[1]);
+  if(count > 2) nodelay = ATOI(tokens[2]);
+  ZLOGFAIL(nodelay != 0 && nodelay != 1, EFAULT, "invalid nodelay argument");
+  NativeSetOptions(bufsize, nodelay);
+  ZLOGS(LOG_DEBUG, "transport = %s, bufsize = %d, nodelay = %d",
+      names[transport], bufsize, nodelay);
+}
+
 /*
  * initiate networking (if there are network channels)
  * note: will run only once on the 1st channel construction
@@ -265,10 +454,15 @@ static INLINE void NetCtor()
 {
   /* context will be get at the very 1st call */
   if(channels_cnt++) return;
+  netchannels = g_ptr_array_new();
 
-  /* get zmq context */
-  context = zmq_init(1);
-  ZLOGFAIL(context == NULL, EFAULT, "cannot initialize zeromq context");
+  /* get zmq context (only if zmq transport is used) */
+  SetTransport();
+  if(transport == TransportZMQ)
+  {
+    context = zmq_init(1);
+    ZLOGFAIL(context == NULL, EFAULT, "cannot initialize zeromq context");
+  }
 
   /* initialize name service */
   NameServiceCtor();
@@ -325,14 +519,108 @@ static INLINE void NetDtor()
   /* context will be destroyed at the last call */
   if(--channels_cnt) return;
 
-  /* temporary fix to make zmq_term() working */
-  CloseChannels();
+  if(context != NULL)
+  {
+    /* temporary fix to make zmq_term() working */
+    CloseChannels();
 
-  /* terminate context */
-  zmq_term(context);
+    /* terminate context */
+    zmq_term(context);
+    context = NULL;
+  }
 
   /* release name service */
   NameServiceDtor();
+  g_ptr_array_free(netchannels, TRUE);
+  netchannels = NULL;
+}
+
+/*
+ * broadcast channel has the list of the subscribers: "tcp:id1+id2+...:".
+ * the comma cannot be used, it separates the channel attributes
+ */
+static INLINE int IsBroadcast(const struct ChannelDesc *channel)
+{
+  return strchr(channel->name, '+') != NULL;
+}
+
+/*
+ * construct the broadcast channel. each subscriber gets own native
+ * "connect" channel (a copy of the broadcast one with the subscriber
+ * url), so the subscribers read it as the usual network channel
+ */
+static void BroadcastCtor(struct ChannelDesc *channel)
+{
+  char *buf[BIG_ENOUGH_STRING], **tokens = buf;
+  char *ids[BIG_ENOUGH_STRING];
+  char name[BIG_ENOUGH_STRING];
+  int i;
+
+  ZLOGFAIL(transport != TransportNative, EFAULT,
+      "%s is a broadcast channel and needs native transport", channel->alias);
+  ZLOGFAIL(!NameServiceSet(), EFAULT,
+      "%s is a broadcast channel and needs name service", channel->alias);
+  ZLOGFAIL(channel->limits[GetsLimit] && channel->limits[GetSizeLimit], EFAULT,
+      "%s is a broadcast channel and must be write-only", channel->alias);
+
+  /* the broadcast channel itself has no sockets */
+  channel->handle = -1;
+  channel->poller = -1;
+
+  /* get the subscribers ids */
+  g_strlcpy(name, channel->name, BIG_ENOUGH_STRING);
+  ParseValue(name, ":", tokens, BIG_ENOUGH_STRING);
+  ZLOGFAIL(tokens[1] == NULL, EFAULT, "%s has invalid url", channel->alias);
+  channel->peers_count = ParseValue(tokens[1], "+", ids, BIG_ENOUGH_STRING);
+  channel->peers = g_malloc0(channel->peers_count * sizeof *channel->peers);
+
+  /* construct the subscribers "connect" channels */
+  for(i = 0; i < channel->peers_count; ++i)
+  {
+    struct ChannelDesc *peer = &channel->peers[i];
+
+    *peer = *channel;
+    peer->name = g_strdup_printf("tcp:%s:", ids[i]);
+    peer->peers = NULL;
+    peer->peers_count = 0;
+    peer->tag = NULL;
+
+    ZLOGFAIL(NativeChannelCtor(peer) != 0, errno,
+        "cannot initialize %s", peer->name);
+    StoreChannelConnectionInfo(peer);
+    ++connects;
+  }
+
+  ZLOGS(LOG_DEBUG, "%s broadcasts to %d subscribers",
+      channel->alias, channel->peers_count);
+  PartitionCtor(channel);
+}
+
+/*
+ * send eof to the broadcast channel subscribers and close them. the
+ * partition channel subscribers get the digests of own records
+ */
+static void BroadcastDtor(struct ChannelDesc *channel,
+    const char *digest, int32_t size)
+{
+  int partition = channel->partition != NULL;
+  int i;
+
+  ConnectChannels();
+  PartitionDtor(channel);
+  for(i = 0; i < channel->peers_count; ++i)
+  {
+    struct ChannelDesc *peer = &channel->peers[i];
+
+    if(!peer->cancelled)
+      NativeSendEOF(peer, partition ? peer->digest : digest, size);
+    NativeChannelDtor(peer);
+    g_free((char*)peer->name);
+  }
+
+  g_free(channel->peers);
+  channel->peers = NULL;
+  channel->peers_count = 0;
 }
 
 int PrefetchChannelCtor(struct ChannelDesc *channel)
@@ -353,13 +641,35 @@ int PrefetchChannelCtor(struct ChannelDesc *channel)
 
   /* open zmq socket. will run only 1st time */
   NetCtor();
+  channel->transport = transport;
+  channel->peers = NULL;
+  channel->peers_count = 0;
+  channel->partition = NULL;
+  g_ptr_array_add(netchannels, channel);
+
+  /* broadcast channel has no own connection */
+  if(IsBroadcast(channel))
+  {
+    BroadcastCtor(channel);
+    return 0;
+  }
+
+  /* update netlist with the connection info */
+  StoreChannelConnectionInfo(channel);
 
   /* choose connection type and open socket */
-  sock_type = channel->limits[GetsLimit]
-      && channel->limits[GetSizeLimit] ? ZMQ_PULL : ZMQ_PUSH;
-  channel->socket = zmq_socket(context, sock_type);
-  ZLOGFAIL(channel->socket == NULL, EFAULT,
-      "cannot get socket for %s", channel->alias);
+  sock_type = IsBinder(channel) ? ZMQ_PULL : ZMQ_PUSH;
+  if(transport == TransportNative)
+  {
+    ZLOGFAIL(NativeChannelCtor(channel) != 0, errno,
+        "cannot initialize %s", channel->alias);
+  }
+  else
+  {
+    channel->socket = zmq_socket(context, sock_type);
+    ZLOGFAIL(channel->socket == NULL, EFAULT,
+        "cannot get socket for %s", channel->alias);
+  }
 
   /* bind or connect the channel */
   if(sock_type == ZMQ_PUSH)
@@ -369,8 +679,11 @@ int PrefetchChannelCtor(struct ChannelDesc *channel)
   }
   else
   {
-    int result = zmq_msg_init(&channel->msg);
-    ZMQ_TEST_STATE(result, &channel->msg);
+    if(transport == TransportZMQ)
+    {
+      int result = zmq_msg_init(&channel->msg);
+      ZMQ_TEST_STATE(result, &channel->msg);
+    }
     PrepareBind(channel);
     ++binds;
   }
@@ -415,6 +728,13 @@ int32_t FetchMessage(struct ChannelDesc *channel, char *buf, int32_t count)
   assert(channel->bufend >= 0);
   assert(channel->bufend <= NET_BUFFER_SIZE);
 
+  /* the 1st access waits for the lazy connection */
+  ConnectChannels();
+
+  /* native transport receives straight to the given buffer */
+  if(channel->transport == TransportNative)
+    return NativeFetch(channel, buf, count);
+
   /*
    * read message part by part until "count" not reached.
    * the part size defined as 64kb
@@ -462,6 +782,21 @@ int32_t SendMessage(struct ChannelDesc *channel, const char *buf, int32_t count)
   assert(channel != NULL);
   assert(buf != NULL);
 
+  /* the 1st access waits for the lazy connection */
+  ConnectChannels();
+
+  /* partition channel routes the records to the subscribers */
+  if(channel->partition != NULL)
+    return PartitionSend(channel, buf, count);
+
+  /* broadcast channel fans the buffer out to the subscribers */
+  if(channel->peers != NULL)
+    return NativeBroadcast(channel, buf, count);
+
+  /* native transport sends the whole buffer as the single frame */
+  if(channel->transport == TransportNative)
+    return NativeSend(channel, buf, count);
+
   /* write EOF as a multi-part message if etag enabled */
   flag = channel->eof ? ZMQ_SNDMORE : 0;
 
@@ -517,37 +852,64 @@ int PrefetchChannelDtor(struct ChannelDesc *channel)
   char url[BIG_ENOUGH_STRING];  /* debug purposes only */
 
   assert(channel != NULL);
-  assert(channel->socket != NULL);
+  assert(channel->socket != NULL || channel->transport == TransportNative);
 
   /* log parameters and channel internals */
-  MakeURL(url, BIG_ENOUGH_STRING, channel, GetChannelConnectionInfo(channel));
-  ZLOGS(LOG_DEBUG, "%s has url %s", channel->alias, url);
+  if(channel->peers == NULL)
+  {
+    MakeURL(url, BIG_ENOUGH_STRING, channel, GetChannelConnectionInfo(channel));
+    ZLOGS(LOG_DEBUG, "%s has url %s", channel->alias, url);
+  }
 
   /* close "PUT" channel */
   if(channel->limits[PutsLimit] && channel->limits[PutSizeLimit])
   {
-    int size = channel->tag != NULL ? TAG_DIGEST_SIZE - 1 : 0;
+    /* duplex channel keeps the written data digest aside */
+    void **tag = channel->duplex ? &channel->wtag : &channel->tag;
+    char *digest = channel->duplex ? channel->wdigest : channel->digest;
+    int size = *tag != NULL ? TAG_DIGEST_SIZE - 1 : 0;
 
     /* prepare digest */
-    if(channel->tag != NULL)
+    if(*tag != NULL)
     {
-      TagDigest(channel->tag, channel->digest);
-      TagDtor(channel->tag);
-      channel->tag = NULL;
+      TagDigest(*tag, digest);
+      TagDtor(*tag);
+      *tag = NULL;
     }
 
-    /* send eof */
-    channel->eof = 1;
-    SendMessage(channel, channel->digest, size);
+    /* send eof. native eof does not touch the (duplex) reading state */
+    if(channel->peers != NULL)
+      BroadcastDtor(channel, digest, size);
+    else if(channel->transport == TransportNative)
+    {
+      ConnectChannels();
+      NativeSendEOF(channel, digest, size);
+    }
+    else
+    {
+      channel->eof = 1;
+      SendMessage(channel, digest, size);
+    }
     ZLOGS(LOG_DEBUG, "%s closed with tag %s, putsize %ld",
-        channel->alias, channel->digest, channel->counters[PutSizeLimit]);
+        channel->alias, digest, channel->counters[PutSizeLimit]);
   }
 
   /* close "GET" channel */
   if(channel->limits[GetsLimit] && channel->limits[GetSizeLimit])
   {
+    /*
+     * native simplex channel is cancelled instead of being wound to
+     * the end. duplex channel upstream is the data, so it is wound
+     */
+    if(channel->transport == TransportNative && channel->eof == 0
+        && !channel->duplex)
+    {
+      ConnectChannels();
+      NativeCancel(channel);
+    }
+
     /* wind the channel to the end */
-    while(channel->eof == 0)
+    while(channel->eof == 0 && !channel->cancelled)
     {
       char buf[NET_BUFFER_SIZE];
       int32_t size = FetchMessage(channel, buf, NET_BUFFER_SIZE);
@@ -567,8 +929,9 @@ int PrefetchChannelDtor(struct ChannelDesc *channel)
       TagDtor(channel->tag);
       channel->tag = NULL;
 
-      /* raise the error if the data corrupted */
-      if(memcmp(channel->control, channel->digest, TAG_DIGEST_SIZE) != 0)
+      /* raise the error if the data corrupted (cancelled data is partial) */
+      if(!channel->cancelled
+          && memcmp(channel->control, channel->digest, TAG_DIGEST_SIZE) != 0)
       {
         ZLOG(LOG_ERROR, "%s corrupted, control: %s, local: %s",
             channel->alias, channel->control, channel->digest);
@@ -580,10 +943,26 @@ int PrefetchChannelDtor(struct ChannelDesc *channel)
           channel->alias, channel->digest, channel->counters[GetSizeLimit]);
     }
 
-    zmq_msg_close(&channel->msg);
-    zmq_close(channel->socket);
+    if(channel->transport == TransportZMQ)
+    {
+      zmq_msg_close(&channel->msg);
+      zmq_close(channel->socket);
+    }
   }
 
+  /* remove the local endpoint socket file of "bind" channel (if bound) */
+  if(channel->peers == NULL && GetChannelConnectionInfo(channel)->local)
+  {
+    g_snprintf(url, BIG_ENOUGH_STRING, LOCAL_CHANNEL_PATH, getuid(),
+        GetChannelConnectionInfo(channel)->port);
+    ZLOGIF(unlink(url) != 0 && errno != ENOENT,
+        "cannot remove %s: %s", url, strerror(errno));
+  }
+
+  /* native channels are closed here in both directions */
+  if(channel->transport == TransportNative)
+    NativeChannelDtor(channel);
+
   /* will destroy context and netlist after all network channels closed */
   NetDtor();
 
@@ -0,0 +1,273 @@
+/*
+ * work queue channel. the splits are numbered through all inputs in
+ * the inputs order: ceil(input size / split size) splits per input,
+ * the last split of the input can be shorter. the split index is taken
+ * from the shared counter: the name server keeps it for the job, the
+ * nodes of one host can use the counter file instead (local stand-in).
+ * all nodes sharing the queue must have the same inputs
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "src/main/manifest_parser.h"
+#include "src/main/manifest_setup.h"
+#include "src/channels/name_service.h"
+#include "src/channels/queue.h"
+
+#define FNV_OFFSET 0x811c9dc5U
+#define FNV_PRIME 0x01000193U
+
+/* the counter file. zero filled file is a new queue */
+struct Counter
+{
+  uint64_t next; /* the next split index */
+  uint64_t splits; /* set by the 1st node */
+};
+
+struct Input
+{
+  int32_t handle; /* the user channel descriptor */
+  int64_t size;
+  uint32_t first; /* the 1st split index */
+};
+
+struct Queue
+{
+  int64_t split; /* split size */
+  uint32_t id; /* the name server queue id */
+  uint32_t splits; /* splits number */
+  uint32_t sequence; /* the name server request number */
+  struct Counter *counter; /* NULL if the name server is used */
+  struct Input *inputs;
+  int count; /* inputs number */
+  int over;
+};
+
+static uint32_t Hash(const char *s)
+{
+  uint32_t hash = FNV_OFFSET;
+
+  for(; *s != '\0'; ++s)
+  {
+    hash ^= (uint8_t)*s;
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+/* return the next split index or NS_WORK_DONE */
+static uint32_t NextSplit(struct Queue *q)
+{
+  uint64_t next;
+
+  if(q->counter == NULL)
+    return RequestSplit(q->id, q->splits, ++q->sequence);
+
+  next = __sync_fetch_and_add(&q->counter->next, 1);
+  return next < q->splits ? next : NS_WORK_DONE;
+}
+
+int32_t QueueFetch(struct ChannelDesc *channel, char *buf, int32_t count)
+{
+  struct ZVMSplit split = {0};
+  struct Queue *q;
+  uint32_t number;
+  int i;
+
+  assert(channel != NULL);
+  assert(channel->socket != NULL);
+  assert(buf != NULL);
+
+  q = channel->socket;
+  if(count < (int32_t)sizeof split)
+  {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  /* the exhausted queue stays exhausted */
+  if(q->over) return 0;
+  number = NextSplit(q);
+  if(number == NS_WORK_DONE)
+  {
+    q->over = 1;
+    return 0;
+  }
+
+  /* find the input of the split */
+  for(i = q->count - 1; q->inputs[i].first > number; --i);
+  split.channel = q->inputs[i].handle;
+  split.offset = (int64_t)(number - q->inputs[i].first) * q->split;
+  split.length = MIN(q->split, q->inputs[i].size - split.offset);
+
+  memcpy(buf, &split, sizeof split);
+  ZLOGS(LOG_DEBUG, "%s gave split %u", channel->alias, number);
+  return sizeof split;
+}
+
+/* parse the "Queue" value of the channel. return 0 if there is none */
+static int ParseQueue(const struct ChannelDesc *channel,
+    char *value, int64_t *split, char *path)
+{
+  char *tokens[QUEUE_ATTRIBUTES + 1];
+  int count;
+
+  count = ParseValue(value, ",", tokens, QUEUE_ATTRIBUTES + 1);
+  if(count == 0) return 0;
+
+  ZLOGFAIL(count < QUEUE_ATTRIBUTES - 1 || count > QUEUE_ATTRIBUTES, EFAULT,
+      "Queue has invalid number of arguments");
+  *split = ATOI(tokens[1]);
+  ZLOGFAIL(*split <= 0, EFAULT, "%s has invalid split size", channel->alias);
+  *path = '\0';
+  if(count == QUEUE_ATTRIBUTES)
+    g_strlcpy(path, tokens[2], BIG_ENOUGH_STRING);
+  return 1;
+}
+
+/* fail if the input is not the randomly readable file channel */
+static void CheckInput(const struct ChannelDesc *channel,
+    const struct ChannelDesc *input)
+{
+  ZLOGFAIL(input->source != ChannelRegular || !input->limits[GetsLimit]
+      || !input->limits[GetSizeLimit] || input->type == SGetSPut
+      || input->type == SGetRPut, EFAULT,
+      "%s input %s is not randomly readable file", channel->alias, input->alias);
+}
+
+/* map the local counter file shared by the nodes. return NULL if failed */
+static struct Counter *CounterCtor(const char *path, uint32_t splits)
+{
+  struct stat fs;
+  struct Counter *counter;
+  int handle;
+  int code;
+
+  /* any node can create the file */
+  handle = open(path, O_RDWR | O_CREAT, QUEUE_RIGHTS);
+  if(handle < 0) return NULL;
+
+  code = fstat(handle, &fs);
+  if(code == 0 && fs.st_size != sizeof *counter)
+    code = fs.st_size == 0 ? ftruncate(handle, sizeof *counter) : -1;
+
+  counter = code != 0 ? MAP_FAILED : mmap(NULL, sizeof *counter,
+      PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+  close(handle);
+  if(counter == MAP_FAILED) return NULL;
+
+  /* the nodes with the different inputs cannot share the queue */
+  __sync_bool_compare_and_swap(&counter->splits, 0, splits);
+  if(counter->splits != splits)
+  {
+    munmap(counter, sizeof *counter);
+    return NULL;
+  }
+  return counter;
+}
+
+int QueueChannelCtor(struct NaClApp *nap, struct ChannelDesc *channel)
+{
+  char path[BIG_ENOUGH_STRING];
+  struct ChannelDesc *inputs[MAX_CHANNELS_NUMBER];
+  struct Queue *q;
+  int64_t split = 0;
+  uint64_t splits = 0;
+  int count;
+  int i;
+
+  assert(nap != NULL);
+  assert(channel != NULL);
+  assert(channel->source == ChannelQueue);
+
+  ZLOGFAIL(channel->type != SGetSPut, EFAULT,
+      "%s is a queue channel and must be sequential", channel->alias);
+  ZLOGFAIL(channel->limits[PutsLimit] && channel->limits[PutSizeLimit], EFAULT,
+      "%s is a queue channel and must be read-only", channel->alias);
+
+  /* the split size and the counter */
+  ZLOGFAIL(!ParseQueue(channel, GetValueByAlias(MFT_QUEUE, channel->alias),
+      &split, path), EFAULT, "%s has no Queue key", channel->alias);
+  ZLOGFAIL(*path == '\0' && !NameServiceSet(), EFAULT,
+      "%s needs the name server or the counter file", channel->alias);
+
+  /* the inputs */
+  count = GetChannelInputs(nap, channel, QUEUE_PREFIX, inputs);
+
+  q = g_malloc0(sizeof *q);
+  q->split = split;
+  q->id = Hash(channel->alias);
+  q->count = count;
+  q->inputs = g_malloc0(count * sizeof *q->inputs);
+  for(i = 0; i < count; ++i)
+  {
+    struct ChannelDesc *input = inputs[i];
+
+    CheckInput(channel, input);
+
+    q->inputs[i].handle = input - nap->system_manifest->channels;
+    q->inputs[i].size = input->size;
+    q->inputs[i].first = splits;
+    splits += (input->size + split - 1) / split;
+    ZLOGFAIL(splits >= NS_WORK_DONE, EFAULT, "%s has too many splits", channel->alias);
+  }
+  q->splits = splits;
+
+  if(*path != '\0')
+  {
+    q->counter = CounterCtor(path, q->splits);
+    ZLOGFAIL(q->counter == NULL, EFAULT, "%s cannot use the counter file %s",
+        channel->alias, path);
+  }
+
+  channel->socket = q;
+  channel->handle = -1;
+  channel->size = 0;
+  channel->getpos = 0;
+  channel->putpos = 0;
+  ZLOGS(LOG_DEBUG, "%s has %u splits of %ld bytes from %d inputs (%s)",
+      channel->alias, q->splits, q->split, count,
+      q->counter == NULL ? "name server" : path);
+  return 0;
+}
+
+int QueueChannelDtor(struct ChannelDesc *channel)
+{
+  struct Queue *q;
+
+  assert(channel != NULL);
+  assert(channel->socket != NULL);
+
+  q = channel->socket;
+  if(q->counter != NULL)
+    munmap(q->counter, sizeof *q->counter);
+
+  if(channel->tag != NULL)
+  {
+    TagDigest(channel->tag, channel->digest);
+    TagDtor(channel->tag);
+    channel->tag = NULL;
+  }
+
+  ZLOGS(LOG_DEBUG, "%s closed with tag %s, %ld splits taken", channel->alias,
+      channel->digest, channel->counters[GetSizeLimit] / (int64_t)sizeof(struct ZVMSplit));
+  g_free(q->inputs);
+  g_free(q);
+  channel->socket = NULL;
+  return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * work queue channel. the inputs (random readable channels) are cut
+ * to the splits, each read of the channel returns the next not taken
+ * split. the nodes of the job share the queue, so the idle node takes
+ * more work instead of waiting for the slow one
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef QUEUE_H_
+#define QUEUE_H_
+
+#include "src/channels/mount_channel.h"
+
+#define QUEUE_PREFIX "queue:"
+#define QUEUE_ATTRIBUTES 3 /* alias, split size, counter file (optional) */
+#define QUEUE_RIGHTS S_IRUSR | S_IWUSR
+
+/*
+ * construct the work queue channel "queue:alias1+alias2+...". the
+ * inputs are the channels mounted before, the split size and the
+ * coordination (name server or the local counter file) are taken from
+ * the manifest "Queue" key. return 0 if successful
+ */
+int QueueChannelCtor(struct NaClApp *nap, struct ChannelDesc *channel);
+
+/*
+ * take the next split and put it to "buf" as struct ZVMSplit. return
+ * the split size (0 - the queue is over) or -1 with errno set if failed
+ */
+int32_t QueueFetch(struct ChannelDesc *channel, char *buf, int32_t count);
+
+/* release the work queue channel. the inputs are closed as usual channels */
+int QueueChannelDtor(struct ChannelDesc *channel);
+
+#endif /* QUEUE_H_ */
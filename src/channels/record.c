@@ -0,0 +1,247 @@
+/*
+ * record framed channels. the data is read from the channel source to
+ * the read ahead buffer, the user gets the whole records from it. the
+ * source position is kept aside, the user sees the records position
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include "src/main/manifest_parser.h"
+#include "src/main/manifest_setup.h"
+#include "src/channels/record.h"
+
+struct Record
+{
+  int delimiter; /* the record delimiter or -1 for the length prefix */
+  char *buffer; /* read ahead buffer */
+  int32_t capacity;
+  int32_t pos; /* the 1st not read byte */
+  int32_t end; /* the read ahead data end */
+  int64_t position; /* the source read position */
+  int64_t fetched; /* bytes read from the source. limited by GetSizeLimit */
+  int eof; /* the source is over */
+};
+
+int64_t PrefixedRecordSize(const char *buf, int32_t count)
+{
+  uint32_t length;
+
+  if(count < RECORD_PREFIX_SIZE) return -1;
+  memcpy(&length, buf, sizeof length);
+  if(length > RECORD_MAX - RECORD_PREFIX_SIZE) return 0;
+  return RECORD_PREFIX_SIZE + length;
+}
+
+/*
+ * return the size of the record starting at "buf" (the prefixed record
+ * can be incomplete) or -1 if the size is unknown yet. invalid size
+ * returns 0
+ */
+static int64_t RecordSize(const struct Record *r, const char *buf, int32_t count)
+{
+  char *end;
+
+  if(r->delimiter < 0) return PrefixedRecordSize(buf, count);
+
+  end = memchr(buf, r->delimiter, count);
+  return end == NULL ? -1 : end - buf + 1;
+}
+
+/* return the size of the whole records fit "size" */
+static int32_t WholeRecords(const struct Record *r, const char *buf,
+    int32_t count, int32_t size)
+{
+  int32_t whole = 0;
+
+  for(count = MIN(count, size); whole < count;)
+  {
+    int64_t next = RecordSize(r, buf + whole, count - whole);
+    if(next <= 0 || next > count - whole) break;
+    whole += next;
+  }
+  return whole;
+}
+
+/*
+ * read more data from the source (not beyond the channel getsize limit).
+ * return -errno if failed
+ */
+static int32_t Refill(struct ChannelDesc *channel, struct Record *r, int32_t need)
+{
+  int32_t avail = r->end - r->pos;
+  int64_t room;
+  int32_t result;
+
+  memmove(r->buffer, r->buffer + r->pos, avail);
+  r->pos = 0;
+  r->end = avail;
+  if(need > r->capacity)
+  {
+    r->capacity = need;
+    r->buffer = g_realloc(r->buffer, r->capacity);
+  }
+
+  room = MIN(r->capacity - r->end, channel->limits[GetSizeLimit] - r->fetched);
+  if(room <= 0) return -EDQUOT;
+
+  result = ChannelRead(channel, r->buffer + r->end, room, r->position);
+  if(result < 0) return result;
+  if(result == 0) r->eof = 1;
+  r->end += result;
+  r->position += result;
+  r->fetched += result;
+  return result;
+}
+
+int32_t RecordFetch(struct ChannelDesc *channel, char *buf, int32_t size)
+{
+  struct Record *r;
+
+  assert(channel != NULL);
+  assert(channel->record != NULL);
+  assert(buf != NULL);
+
+  r = channel->record;
+  for(;;)
+  {
+    int32_t avail = r->end - r->pos;
+    int32_t whole = WholeRecords(r, r->buffer + r->pos, avail, size);
+    int64_t next;
+
+    if(whole > 0)
+    {
+      memcpy(buf, r->buffer + r->pos, whole);
+      r->pos += whole;
+      return whole;
+    }
+
+    /* the next record is invalid or does not fit the user buffer */
+    next = RecordSize(r, r->buffer + r->pos, avail);
+    if(next == 0 || avail > RECORD_MAX)
+    {
+      ZLOG(LOG_ERROR, "%s has the record of invalid size", channel->alias);
+      return -EIO;
+    }
+    if(next > size) return -EMSGSIZE;
+
+    /* the source is over. the delimiter is optional for the last record */
+    if(r->eof)
+    {
+      if(avail == 0) return 0;
+      if(r->delimiter < 0)
+      {
+        ZLOG(LOG_ERROR, "%s has incomplete last record", channel->alias);
+        r->pos = r->end;
+        return -EIO;
+      }
+      if(avail > size) return -EMSGSIZE;
+      memcpy(buf, r->buffer + r->pos, avail);
+      r->pos = r->end;
+      return avail;
+    }
+    if(next < 0 && avail >= size && r->delimiter >= 0) return -EMSGSIZE;
+
+    /* read the rest of the record. the full buffer grows */
+    next = MAX(next, avail < r->capacity ? r->capacity : 2 * r->capacity);
+    next = Refill(channel, r, next);
+    if(next < 0) return next;
+  }
+}
+
+int RecordPending(const struct ChannelDesc *channel)
+{
+  const struct Record *r = channel->record;
+  return r != NULL && r->end > r->pos;
+}
+
+int RecordCheck(const struct ChannelDesc *channel, const char *buf, int32_t size)
+{
+  const struct Record *r;
+
+  assert(channel != NULL);
+  assert(channel->record != NULL);
+
+  r = channel->record;
+  if(r->delimiter >= 0) return size > 0 && buf[size - 1] == r->delimiter ? 0 : -1;
+  return WholeRecords(r, buf, size, size) == size ? 0 : -1;
+}
+
+/* parse the "Record" value of the channel. return 0 if there is none */
+static int ParseRecord(const struct ChannelDesc *channel, char *value, int *delimiter)
+{
+  char *tokens[RECORD_ATTRIBUTES + 1];
+  int count;
+
+  count = ParseValue(value, ",", tokens, RECORD_ATTRIBUTES + 1);
+  if(count == 0) return 0;
+
+  ZLOGFAIL(count != RECORD_ATTRIBUTES, EFAULT,
+      "Record has invalid number of arguments");
+  *delimiter = STREQ(tokens[1], RECORD_PREFIX) ? -1 : ATOI(tokens[1]);
+  ZLOGFAIL(*delimiter > UINT8_MAX || (*delimiter < 0
+      && !STREQ(tokens[1], RECORD_PREFIX)), EFAULT,
+      "%s has invalid record framing %s", channel->alias, tokens[1]);
+  return 1;
+}
+
+void RecordChannelCtor(struct ChannelDesc *channel)
+{
+  struct Record *r;
+  int delimiter;
+
+  assert(channel != NULL);
+
+  channel->record = NULL;
+  if(!ParseRecord(channel, GetValueByAlias(MFT_RECORD, channel->alias), &delimiter))
+    return;
+
+  ZLOGFAIL(channel->type != SGetSPut, EFAULT,
+      "%s is a record channel and must be sequential", channel->alias);
+
+  r = g_malloc0(sizeof *r);
+  r->delimiter = delimiter;
+  r->position = channel->getpos;
+  if(channel->limits[GetsLimit] && channel->limits[GetSizeLimit])
+  {
+    r->capacity = RECORD_BUFFER_SIZE;
+    r->buffer = g_malloc(r->capacity);
+  }
+
+  channel->record = r;
+  if(delimiter < 0)
+    ZLOGS(LOG_DEBUG, "%s has records prefixed with length", channel->alias);
+  else
+    ZLOGS(LOG_DEBUG, "%s has records delimited with %d", channel->alias, delimiter);
+}
+
+void RecordChannelDtor(struct ChannelDesc *channel)
+{
+  struct Record *r;
+
+  assert(channel != NULL);
+
+  r = channel->record;
+  if(r == NULL) return;
+
+  /* the tag covers the data taken from the source (the etag check) */
+  ZLOGIF(r->end > r->pos, "%s closed with %d bytes read ahead",
+      channel->alias, r->end - r->pos);
+  if(r->end > r->pos && channel->tag != NULL)
+    TagUpdate(channel->tag, r->buffer + r->pos, r->end - r->pos);
+  g_free(r->buffer);
+  g_free(r);
+  channel->record = NULL;
+}
@@ -0,0 +1,64 @@
+/*
+ * record framed channels. the read returns the whole records only,
+ * the write must contain the whole records only. the records are
+ * either prefixed with the length or ended with the delimiter
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RECORD_H_
+#define RECORD_H_
+
+#include "src/channels/mount_channel.h"
+
+#define RECORD_ATTRIBUTES 2 /* alias, framing */
+#define RECORD_PREFIX "prefix" /* 32-bit little endian length prefix */
+#define RECORD_PREFIX_SIZE 4 /* 32-bit little endian length prefix */
+#define RECORD_BUFFER_SIZE 0x100000 /* the read ahead buffer */
+#define RECORD_MAX 0x1000000 /* the biggest record allowed */
+
+/*
+ * make the channel record framed if the manifest has "Record" key
+ * for its alias. should be called for the mounted channel
+ */
+void RecordChannelCtor(struct ChannelDesc *channel);
+
+/*
+ * release the read ahead buffer. the unread data is added to the channel
+ * tag, so it must be called before the channel source is closed
+ */
+void RecordChannelDtor(struct ChannelDesc *channel);
+
+/*
+ * read as many whole records as fit "size". return the read bytes
+ * number (0 - eof) or -errno. -EMSGSIZE if the next record is bigger
+ * than "size" (the record is kept for the next read)
+ */
+int32_t RecordFetch(struct ChannelDesc *channel, char *buf, int32_t size);
+
+/* return not 0 if the channel has the records read ahead */
+int RecordPending(const struct ChannelDesc *channel);
+
+/* return 0 if "buf" contains the whole records only */
+int RecordCheck(const struct ChannelDesc *channel, const char *buf, int32_t size);
+
+/*
+ * return the size of the length prefixed record starting at "buf" or
+ * -1 if the prefix is not complete yet. invalid size returns 0. the
+ * same framing is used by the merge and partition channels
+ */
+int64_t PrefixedRecordSize(const char *buf, int32_t count);
+
+#endif /* RECORD_H_ */
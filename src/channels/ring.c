@@ -0,0 +1,366 @@
+/*
+ * shared memory ring channels. the writer and the reader map the
+ * same file and exchange the data through the ring without the
+ * kernel involvement. the parties sleep on futexes only when the
+ * ring is empty (reader) or full (writer)
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "src/main/manifest_parser.h"
+#include "src/main/manifest_setup.h"
+#include "src/channels/ring.h"
+
+#define RING_PREFIX "ipc:"
+#define RING_FILE_SIZE (RING_HEADER_SIZE + RING_SIZE)
+#define RING_DATA(ring) ((char*)(ring) + RING_HEADER_SIZE)
+#define RING_RIGHTS S_IRUSR | S_IWUSR
+
+/* readable and writable limits */
+#define IS_READER(channel) \
+  ((channel)->limits[GetsLimit] && (channel)->limits[GetSizeLimit])
+#define IS_WRITER(channel) \
+  ((channel)->limits[PutsLimit] && (channel)->limits[PutSizeLimit])
+
+/* sleep while the futex word has the given value (at most RING_WAIT) */
+static void Sleep(volatile int32_t *word, int32_t value)
+{
+  struct timespec wait = {0, RING_WAIT * 1000000};
+  syscall(SYS_futex, word, FUTEX_WAIT, value, &wait, NULL, 0);
+}
+
+/* change the futex word and wake up the other party */
+static void Wake(volatile int32_t *word)
+{
+  __sync_fetch_and_add(word, 1);
+  syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* the channel ring file name */
+static INLINE const char *RingPath(const struct ChannelDesc *channel)
+{
+  return channel->name + sizeof RING_PREFIX - 1;
+}
+
+/* return 1 if the party with the given pid is alive */
+static int Alive(int32_t pid)
+{
+  return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+/* remove the stale ring and create the new (empty) one */
+static void *Create(const char *path)
+{
+  struct RingHeader *ring;
+  int handle;
+
+  unlink(path);
+  handle = open(path, O_RDWR | O_CREAT | O_EXCL, RING_RIGHTS);
+  if(handle < 0) return MAP_FAILED;
+
+  ring = ftruncate(handle, RING_FILE_SIZE) != 0 ? MAP_FAILED
+      : mmap(NULL, RING_FILE_SIZE, PROT_READ | PROT_WRITE,
+      MAP_SHARED, handle, 0);
+  close(handle);
+  if(ring == MAP_FAILED) return MAP_FAILED;
+
+  __sync_synchronize();
+  ring->reader = getpid();
+  return ring;
+}
+
+/*
+ * join the ring created by the reader. the ring of the dead reader is
+ * stale unless the reader cancelled it before the writer came. the
+ * joined writer removes the file: both parties have it mapped already
+ */
+static void *Join(const char *path)
+{
+  struct RingHeader *ring;
+  struct stat fs;
+  struct stat ps;
+  int handle;
+  int32_t reader;
+
+  handle = open(path, O_RDWR);
+  if(handle < 0) return MAP_FAILED;
+
+  ring = fstat(handle, &fs) != 0 || fs.st_size != RING_FILE_SIZE
+      ? MAP_FAILED : mmap(NULL, RING_FILE_SIZE, PROT_READ | PROT_WRITE,
+      MAP_SHARED, handle, 0);
+  close(handle);
+  if(ring == MAP_FAILED) return MAP_FAILED;
+
+  reader = ring->reader;
+  if(reader == 0 || !(Alive(reader) || ring->cancelled)
+      || !__sync_bool_compare_and_swap(&ring->writer, 0, getpid()))
+  {
+    munmap(ring, RING_FILE_SIZE);
+    return MAP_FAILED;
+  }
+
+  if(stat(path, &ps) == 0 && ps.st_ino == fs.st_ino && ps.st_dev == fs.st_dev)
+    unlink(path);
+  return ring;
+}
+
+int RingChannelCtor(struct ChannelDesc *channel)
+{
+  void *ring;
+  time_t deadline;
+
+  assert(channel != NULL);
+  assert(channel->source == ChannelIPC);
+
+  ZLOGFAIL(channel->type != SGetSPut, EFAULT,
+      "%s is a ring channel and must be sequential", channel->alias);
+  ZLOGFAIL(IS_READER(channel) == IS_WRITER(channel), EFAULT,
+      "%s is a ring channel and must be read-only or write-only",
+      channel->alias);
+  ZLOGFAIL(strncmp(channel->name, RING_PREFIX, sizeof RING_PREFIX - 1) != 0
+      || *RingPath(channel) == '\0', EFAULT, "%s has invalid name %s",
+      channel->alias, channel->name);
+
+  /* the reader creates the ring, the writer waits for it */
+  if(IS_READER(channel))
+    ring = Create(RingPath(channel));
+  else
+  {
+    deadline = time(NULL) + MAX(ATOI(GetValueByKey(MFT_TIMEOUT)), 1);
+    while((ring = Join(RingPath(channel))) == MAP_FAILED
+        && time(NULL) < deadline)
+      usleep(RING_JOIN_WAIT * 1000);
+    ZLOGIF(ring == MAP_FAILED, "%s has no reader", channel->alias);
+  }
+  if(ring == MAP_FAILED) return -1;
+
+  channel->socket = ring;
+  channel->bufpos = 0;
+  channel->bufend = 0;
+  ZLOGS(LOG_DEBUG, "%s mapped ring %s", channel->alias, RingPath(channel));
+  return 0;
+}
+
+int32_t RingFetch(struct ChannelDesc *channel, char *buf, int32_t count)
+{
+  struct RingHeader *ring;
+  uint64_t tail;
+  int32_t readrest;
+
+  assert(channel != NULL);
+  assert(channel->socket != NULL);
+  assert(buf != NULL);
+
+  ring = channel->socket;
+  tail = ring->tail;
+
+  for(readrest = count; readrest > 0 && channel->eof == 0;)
+  {
+    uint64_t head = ring->head;
+    int32_t toread;
+    int32_t offset;
+
+    /* ring is empty. check eof or wait for the writer */
+    if(head == tail)
+    {
+      int32_t seq = ring->data_seq;
+      int eof = ring->eof;
+
+      /* the last data is taken after eof observed */
+      __sync_synchronize();
+      if(eof && ring->head == tail)
+      {
+        memcpy(channel->control, ring->control, TAG_DIGEST_SIZE);
+        channel->eof = 1;
+        break;
+      }
+
+      ring->reader_waits = 1;
+      __sync_synchronize();
+      if(ring->head == tail && ring->eof == 0) Sleep(&ring->data_seq, seq);
+      ring->reader_waits = 0;
+
+      /* the joined writer died before eof */
+      if(ring->head == tail && ring->eof == 0
+          && ring->writer != 0 && !Alive(ring->writer))
+      {
+        ZLOG(LOG_ERROR, "%s writer is gone", channel->alias);
+        errno = EPIPE;
+        return -1;
+      }
+      continue;
+    }
+
+    /* take available data (at most 2 pieces because of the ring wrap) */
+    __sync_synchronize();
+    toread = MIN(readrest, head - tail);
+    offset = tail & (RING_SIZE - 1);
+    if(offset + toread > RING_SIZE)
+    {
+      int32_t part = RING_SIZE - offset;
+      memcpy(buf, RING_DATA(ring) + offset, part);
+      memcpy(buf + part, RING_DATA(ring), toread - part);
+    }
+    else
+      memcpy(buf, RING_DATA(ring) + offset, toread);
+
+    /* release the space and wake the writer up if it waits */
+    tail += toread;
+    buf += toread;
+    readrest -= toread;
+    __sync_synchronize();
+    ring->tail = tail;
+    __sync_synchronize();
+    if(ring->writer_waits) Wake(&ring->space_seq);
+  }
+
+  return count - readrest;
+}
+
+/* write all given data to the ring. return -1 if the reader cancelled or died */
+static int Put(struct RingHeader *ring, const char *buf, int32_t count)
+{
+  uint64_t head = ring->head;
+
+  while(count > 0)
+  {
+    uint64_t tail = ring->tail;
+    int32_t towrite;
+    int32_t offset;
+
+    if(ring->cancelled) return -1;
+
+    /* ring is full. wait for the reader */
+    if(head - tail == RING_SIZE)
+    {
+      int32_t seq = ring->space_seq;
+
+      ring->writer_waits = 1;
+      __sync_synchronize();
+      if(head - ring->tail == RING_SIZE && ring->cancelled == 0)
+        Sleep(&ring->space_seq, seq);
+      ring->writer_waits = 0;
+      if(head - ring->tail == RING_SIZE && !Alive(ring->reader)) return -1;
+      continue;
+    }
+
+    /* put the data (at most 2 pieces because of the ring wrap) */
+    __sync_synchronize();
+    towrite = MIN(count, RING_SIZE - (head - tail));
+    offset = head & (RING_SIZE - 1);
+    if(offset + towrite > RING_SIZE)
+    {
+      int32_t part = RING_SIZE - offset;
+      memcpy(RING_DATA(ring) + offset, buf, part);
+      memcpy(RING_DATA(ring), buf + part, towrite - part);
+    }
+    else
+      memcpy(RING_DATA(ring) + offset, buf, towrite);
+
+    /* publish the data and wake the reader up if it waits */
+    head += towrite;
+    buf += towrite;
+    count -= towrite;
+    __sync_synchronize();
+    ring->head = head;
+    __sync_synchronize();
+    if(ring->reader_waits) Wake(&ring->data_seq);
+  }
+  return 0;
+}
+
+int32_t RingSend(struct ChannelDesc *channel, const char *buf, int32_t count)
+{
+  assert(channel != NULL);
+  assert(channel->socket != NULL);
+  assert(buf != NULL);
+
+  if(Put(channel->socket, buf, count) != 0)
+  {
+    ZLOGS(LOG_DEBUG, "%s cancelled by the reader after %ld bytes",
+        channel->alias, channel->counters[PutSizeLimit]);
+    channel->cancelled = 1;
+    errno = EPIPE;
+    return -1;
+  }
+  return count;
+}
+
+int RingChannelDtor(struct ChannelDesc *channel)
+{
+  struct RingHeader *ring;
+  int tagged;
+
+  assert(channel != NULL);
+  assert(channel->socket != NULL);
+
+  ring = channel->socket;
+  tagged = channel->tag != NULL;
+
+  /* "GET" channel closed before eof: stop the writer */
+  if(IS_READER(channel) && channel->eof == 0)
+  {
+    ring->cancelled = 1;
+    channel->cancelled = 1;
+    Wake(&ring->space_seq);
+  }
+
+  /* prepare digest */
+  if(tagged)
+  {
+    TagDigest(channel->tag, channel->digest);
+    TagDtor(channel->tag);
+    channel->tag = NULL;
+  }
+
+  /* close "PUT" channel: publish the digest and eof */
+  if(IS_WRITER(channel))
+  {
+    memcpy(ring->control, channel->digest, TAG_DIGEST_SIZE);
+    __sync_synchronize();
+    ring->eof = 1;
+    Wake(&ring->data_seq);
+    ZLOGS(LOG_DEBUG, "%s closed with tag %s, putsize %ld",
+        channel->alias, channel->digest, channel->counters[PutSizeLimit]);
+  }
+
+  /* close "GET" channel: test integrity (the writer removed the file) */
+  if(IS_READER(channel))
+  {
+    if(tagged && !channel->cancelled
+        && memcmp(channel->control, channel->digest, TAG_DIGEST_SIZE) != 0)
+    {
+      ZLOG(LOG_ERROR, "%s corrupted, control: %s, local: %s",
+          channel->alias, channel->control, channel->digest);
+      SetExitState("data corrupted");
+      SetExitCode(EPIPE);
+    }
+
+    ZLOGS(LOG_DEBUG, "%s closed with tag %s, getsize %ld",
+        channel->alias, channel->digest, channel->counters[GetSizeLimit]);
+  }
+
+  munmap(ring, RING_FILE_SIZE);
+  channel->socket = NULL;
+  return 0;
+}
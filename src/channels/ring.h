@@ -0,0 +1,89 @@
+/*
+ * shared memory ring channels api. connects two zerovm instances
+ * running on the same host
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RING_H_
+#define RING_H_
+
+#include "src/channels/mount_channel.h"
+
+#define RING_SIZE 0x400000 /* ring data size. must be power of 2 */
+#define RING_HEADER_SIZE 0x1000 /* the ring control page */
+#define RING_LINE 64 /* cache line size */
+#define RING_WAIT 100 /* milliseconds. the sleeping party checks the peer is alive */
+#define RING_JOIN_WAIT 10 /* milliseconds. the writer looks for the reader ring */
+
+/*
+ * the ring control block. placed at the beginning of the shared file,
+ * the data follows the control page. "head" is changed only by the
+ * writer, "tail" - only by the reader. the sequences are the futex
+ * words, they are incremented to wake the waiting party up
+ * note: the reader creates the file (a new zero filled file is a valid
+ * empty ring), the writer joins it while the reader is alive
+ */
+struct RingHeader
+{
+  /* the writer part */
+  volatile uint64_t head; /* total bytes written */
+  volatile int32_t data_seq; /* incremented when the data (or eof) added */
+  volatile int32_t eof; /* set after the last byte written */
+  volatile int32_t writer; /* the writer pid. 0 - not joined yet */
+  char control[TAG_DIGEST_SIZE]; /* the writer etag digest */
+  char pad1[RING_LINE - (TAG_DIGEST_SIZE + 20) % RING_LINE];
+
+  /* the reader part */
+  volatile uint64_t tail; /* total bytes read */
+  volatile int32_t space_seq; /* incremented when the space freed */
+  volatile int32_t reader_waits; /* the reader sleeps on data_seq */
+  volatile int32_t writer_waits; /* the writer sleeps on space_seq */
+  volatile int32_t cancelled; /* the reader will not take the rest */
+  volatile int32_t reader; /* the reader (the file creator) pid */
+};
+
+/*
+ * map the ring file. the channel name has form "ipc:path", path is the
+ * shared file name (better to place it to tmpfs, e.g. /dev/shm). the
+ * reading party creates the file anew (the stale one is removed) and
+ * removes it when closed. the writing party waits (up to the session
+ * timeout) for the file of the live reader. return 0 if successful
+ */
+int RingChannelCtor(struct ChannelDesc *channel);
+
+/*
+ * read "count" bytes from the ring. blocks until "count" bytes read
+ * or eof reached. return number of read bytes or -1 if failed (the
+ * writer died before eof)
+ */
+int32_t RingFetch(struct ChannelDesc *channel, char *buf, int32_t count);
+
+/*
+ * write "count" bytes to the ring. blocks until all data is placed
+ * to the ring. return number of written bytes or -1 if failed. if
+ * the reader cancelled the stream (or died) the channel "cancelled"
+ * is set
+ */
+int32_t RingSend(struct ChannelDesc *channel, const char *buf, int32_t count);
+
+/*
+ * close the ring. the writer puts eof and etag, the reader checks
+ * the etag. the reader closed before eof cancels the stream instead
+ * of winding it to the end (the etag is not checked)
+ */
+int RingChannelDtor(struct ChannelDesc *channel);
+
+#endif /* RING_H_ */
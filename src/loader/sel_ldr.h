@@ -169,6 +169,8 @@ struct NaClApp {
   int                       validation_state; /* needs for the report */
   GString                   *channels_tag; /* all etag digests for report */
   void                      *mem_tag; /* tag context for memory */
+  int                       mem_tag_pages; /* memory tag per page */
+  int                       huge_pages; /* heap and stack on huge pages */
 
   /* former natp field */
   uint32_t                  sysret; /* syscall return code */
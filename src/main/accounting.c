@@ -18,6 +18,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <sys/resource.h>
 #include <glib.h>
 #include "src/loader/sel_ldr.h"
 #include "src/main/accounting.h"
@@ -27,6 +28,12 @@
 /* accounting folder name */
 static char accounting[BIG_ENOUGH_STRING] = DEFAULT_ACCOUNTING;
 
+/* the usage before the user program start (after the heap prefaulting) */
+static struct rusage start_usage;
+
+/* the usage at the user program exit (before the channels finalization) */
+static struct rusage end_usage;
+
 /* populate "buf" with an extended accounting statistics, return string size */
 static int ReadSystemAccounting(const struct NaClApp *nap, char *buf, int size)
 {
@@ -120,8 +127,41 @@ static int GetChannelsAccounting(const struct NaClApp *nap, char *buf, int size)
       network_stats[PutsLimit], network_stats[PutSizeLimit]);
 }
 
+/* get the cpus and the numa node the session was placed to */
+static int GetPlacementAccounting(const struct NaClApp *nap, char *buf, int size)
+{
+  const struct SystemManifest *policy = nap->system_manifest;
+  char numa[INT32_STRLEN];
+
+  g_snprintf(numa, sizeof numa, "%d", policy->numa);
+  return g_snprintf(buf, size, "%s %s",
+      policy->affinity == NULL ? PLACEMENT_ANY : policy->affinity,
+      policy->numa < 0 ? PLACEMENT_ANY : numa);
+}
+
+/*
+ * get the minor and major page faults taken by the user program (from
+ * its start to its exit). the faults of the session setup, including
+ * the heap prefaulting, and of the teardown are not counted
+ */
+static int GetFaultsAccounting(char *buf, int size)
+{
+  return g_snprintf(buf, size, "%ld %ld",
+      end_usage.ru_minflt - start_usage.ru_minflt,
+      end_usage.ru_majflt - start_usage.ru_majflt);
+}
+
 void AccountingCtor(const struct NaClApp *nap)
 {
+  ZLOGIF(getrusage(RUSAGE_SELF, &start_usage) != 0,
+      "cannot get page faults: %s", strerror(errno));
+}
+
+void AccountingStop()
+{
+  if(getrusage(RUSAGE_SELF, &end_usage) == 0) return;
+  ZLOG(LOG_ERR, "cannot get page faults: %s", strerror(errno));
+  end_usage = start_usage;
 }
 
 void AccountingDtor(const struct NaClApp *nap)
@@ -134,6 +174,12 @@ void AccountingDtor(const struct NaClApp *nap)
   strncat(accounting, " ", 1);
   ++offset;
   GetChannelsAccounting(nap, accounting + offset, BIG_ENOUGH_STRING - offset);
+  strncat(accounting, " ", 1);
+  offset = strlen(accounting);
+  GetPlacementAccounting(nap, accounting + offset, BIG_ENOUGH_STRING - offset);
+  strncat(accounting, " ", 1);
+  offset = strlen(accounting);
+  GetFaultsAccounting(accounting + offset, BIG_ENOUGH_STRING - offset);
 }
 
 const char *GetAccountingInfo()
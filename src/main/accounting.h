@@ -25,6 +25,12 @@
 /* initialize accounting */
 void AccountingCtor(const struct NaClApp *nap);
 
+/*
+ * take the end snapshot of the user program page faults. must be called
+ * at the user program exit, before the channels are finalized
+ */
+void AccountingStop();
+
 /* finalize accounting. return string with statistics */
 void AccountingDtor(const struct NaClApp *nap);
 
@@ -1,6 +1,9 @@
 /*
- * routines to calculate hashes. should be constructed from the command
- * line parser. doesn't need destructor.
+ * routines to calculate hashes. the hash engine is selected once by the
+ * manifest "Etag" key before the first context constructed. sha1 and
+ * sha256 use the cpu sha extensions if available (otherwise glib),
+ * xxh64 is the fast non-cryptographic hash. the tree mode hashes the
+ * stream leaves by the thread pool, off the caller thread
  *
  * Copyright (c) 2012, LiteStack, Inc.
  *
@@ -20,32 +23,908 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <cpuid.h>
+#include <immintrin.h>
 #include "src/main/tools.h"
 #include "src/main/etag.h"
 
+#define CPUID_SHA (1 << 29) /* leaf 7, ebx */
+#define SHA_BLOCK 64
+#define XXH_STRIPE 32
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* hash engine interface */
+struct Engine
+{
+  const char *name;
+  void *(*ctor)();
+  void (*update)(void *ctx, const char *buffer, int64_t size);
+  void (*digest)(void *ctx, char *digest); /* must not change the context */
+  void (*dtor)(void *ctx);
+};
+
+/* the sha extensions context */
+struct Sha
+{
+  uint32_t state[8];
+  int words; /* digest size in 32-bit words */
+  void (*blocks)(uint32_t *state, const uint8_t *data, int64_t count);
+  uint8_t block[SHA_BLOCK];
+  int used; /* the incomplete block size */
+  uint64_t length;
+};
+
+struct Xxh64
+{
+  uint64_t v[4];
+  uint8_t stripe[XXH_STRIPE];
+  int used; /* the incomplete stripe size */
+  uint64_t length;
+};
+
+/* the thread pool job */
+struct Job
+{
+  void (*run)(struct Job *job);
+};
+
+/*
+ * the tree context. the stream is cut to the leaves of the fixed size,
+ * the full leaf is hashed by the thread pool. the digest is the root of
+ * the binary tree over the leaves digests in the stream order, so it
+ * does not depend on the threads timing
+ */
+struct Tree
+{
+  GMutex lock;
+  GCond done; /* a leaf hashed */
+  char *leaf; /* the current leaf */
+  int64_t used;
+  char (*digests)[TAG_DIGEST_SIZE]; /* the hashed leaves */
+  int64_t count; /* the leaves submitted */
+  int64_t capacity;
+  int pending; /* the leaves being hashed */
+};
+
+/* the leaf job of the thread pool */
+struct Leaf
+{
+  struct Job job;
+  struct Tree *tree;
+  int64_t index;
+  char *data;
+  int64_t size;
+};
+
+#define PAGEMAP "/proc/self/pagemap"
+#define PAGEMAP_USED (7ULL << 61) /* present, swapped, file page or shared */
+#define TAG_SPAN_PAGES 64 /* the pages hashed by one job */
+
+static const struct Engine *engine = NULL;
+static const struct Engine *base = NULL; /* the tree leaves engine */
+static GChecksumType checksum = G_CHECKSUM_SHA1; /* glib engine type */
+static GThreadPool *pool = NULL; /* the tree leaves hashing */
+static int64_t leaf_size = 0;
+static int pending_max = 0; /* the leaves being hashed per context */
+
+/* glib engine {{ */
+static void *GlibCtor()
+{
+  return g_checksum_new(checksum);
+}
+
+static void GlibUpdate(void *ctx, const char *buffer, int64_t size)
+{
+  g_checksum_update(ctx, (const guchar*)buffer, size);
+}
+
+static void GlibDigest(void *ctx, char *digest)
+{
+  GChecksum *tmp = g_checksum_copy(ctx);
+
+  strcpy(digest, g_checksum_get_string(tmp));
+  g_checksum_free(tmp);
+}
+
+static void GlibDtor(void *ctx)
+{
+  g_checksum_free(ctx);
+}
+/* }} */
+
+/* sha extensions engine {{ */
+static const uint32_t SHA1_INIT[] = {
+  0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+static const uint32_t SHA256_INIT[] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint32_t SHA256_K[] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*
+ * 4 sha1 rounds of the group "g" (0..19). "e" accumulates the message,
+ * "f" takes the state, "m" is the group message, "n", "a", "p" are the
+ * next, after next and previous group messages
+ */
+#define SHA1_ROUNDS(g, e, f, m, n, a, p) \
+  e = _mm_sha1nexte_epu32(e, m); \
+  f = abcd; \
+  if(g >= 3 && g <= 18) n = _mm_sha1msg2_epu32(n, m); \
+  abcd = _mm_sha1rnds4_epu32(abcd, e, g / 5); \
+  if(g >= 1 && g <= 16) p = _mm_sha1msg1_epu32(p, m); \
+  if(g >= 2 && g <= 17) a = _mm_xor_si128(a, m)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void Sha1Blocks(uint32_t *state, const uint8_t *data, int64_t count)
+{
+  const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+  __m128i abcd, e0, e1, m0, m1, m2, m3;
+
+  abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1b);
+  e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+  for(; count > 0; --count, data += SHA_BLOCK)
+  {
+    __m128i abcd_save = abcd;
+    __m128i e0_save = e0;
+
+    m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), mask);
+    m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), mask);
+    m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), mask);
+    m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), mask);
+
+    e0 = _mm_add_epi32(e0, m0);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+    SHA1_ROUNDS(1, e1, e0, m1, m2, m3, m0);
+    SHA1_ROUNDS(2, e0, e1, m2, m3, m0, m1);
+    SHA1_ROUNDS(3, e1, e0, m3, m0, m1, m2);
+    SHA1_ROUNDS(4, e0, e1, m0, m1, m2, m3);
+    SHA1_ROUNDS(5, e1, e0, m1, m2, m3, m0);
+    SHA1_ROUNDS(6, e0, e1, m2, m3, m0, m1);
+    SHA1_ROUNDS(7, e1, e0, m3, m0, m1, m2);
+    SHA1_ROUNDS(8, e0, e1, m0, m1, m2, m3);
+    SHA1_ROUNDS(9, e1, e0, m1, m2, m3, m0);
+    SHA1_ROUNDS(10, e0, e1, m2, m3, m0, m1);
+    SHA1_ROUNDS(11, e1, e0, m3, m0, m1, m2);
+    SHA1_ROUNDS(12, e0, e1, m0, m1, m2, m3);
+    SHA1_ROUNDS(13, e1, e0, m1, m2, m3, m0);
+    SHA1_ROUNDS(14, e0, e1, m2, m3, m0, m1);
+    SHA1_ROUNDS(15, e1, e0, m3, m0, m1, m2);
+    SHA1_ROUNDS(16, e0, e1, m0, m1, m2, m3);
+    SHA1_ROUNDS(17, e1, e0, m1, m2, m3, m0);
+    SHA1_ROUNDS(18, e0, e1, m2, m3, m0, m1);
+    SHA1_ROUNDS(19, e1, e0, m3, m0, m1, m2);
+
+    e0 = _mm_sha1nexte_epu32(e0, e0_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+  }
+
+  _mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1b));
+  state[4] = _mm_extract_epi32(e0, 3);
+}
+
+/*
+ * 4 sha256 rounds of the group "g" (0..15). "m" is the group message,
+ * "n" and "p" are the next and previous group messages
+ */
+#define SHA256_ROUNDS(g, m, n, p) \
+  msg = _mm_add_epi32(m, _mm_loadu_si128((const __m128i*)&SHA256_K[4 * g])); \
+  state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+  if(g >= 3 && g <= 14) \
+    n = _mm_sha256msg2_epu32(_mm_add_epi32(n, _mm_alignr_epi8(m, p, 4)), m); \
+  state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e)); \
+  if(g >= 1 && g <= 12) p = _mm_sha256msg1_epu32(p, m)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void Sha256Blocks(uint32_t *state, const uint8_t *data, int64_t count)
+{
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, msg, tmp, m0, m1, m2, m3;
+
+  /* abcd efgh -> abef cdgh */
+  tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0xb1);
+  state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(state + 4)), 0x1b);
+  state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+  for(; count > 0; --count, data += SHA_BLOCK)
+  {
+    __m128i abef_save = state0;
+    __m128i cdgh_save = state1;
+
+    m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), mask);
+    m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), mask);
+    m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), mask);
+    m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), mask);
+
+    SHA256_ROUNDS(0, m0, m1, m3);
+    SHA256_ROUNDS(1, m1, m2, m0);
+    SHA256_ROUNDS(2, m2, m3, m1);
+    SHA256_ROUNDS(3, m3, m0, m2);
+    SHA256_ROUNDS(4, m0, m1, m3);
+    SHA256_ROUNDS(5, m1, m2, m0);
+    SHA256_ROUNDS(6, m2, m3, m1);
+    SHA256_ROUNDS(7, m3, m0, m2);
+    SHA256_ROUNDS(8, m0, m1, m3);
+    SHA256_ROUNDS(9, m1, m2, m0);
+    SHA256_ROUNDS(10, m2, m3, m1);
+    SHA256_ROUNDS(11, m3, m0, m2);
+    SHA256_ROUNDS(12, m0, m1, m3);
+    SHA256_ROUNDS(13, m1, m2, m0);
+    SHA256_ROUNDS(14, m2, m3, m1);
+    SHA256_ROUNDS(15, m3, m0, m2);
+
+    state0 = _mm_add_epi32(state0, abef_save);
+    state1 = _mm_add_epi32(state1, cdgh_save);
+  }
+
+  /* abef cdgh -> abcd efgh */
+  tmp = _mm_shuffle_epi32(state0, 0x1b);
+  state1 = _mm_shuffle_epi32(state1, 0xb1);
+  _mm_storeu_si128((__m128i*)state, _mm_blend_epi16(tmp, state1, 0xf0));
+  _mm_storeu_si128((__m128i*)(state + 4), _mm_alignr_epi8(state1, tmp, 8));
+}
+
+static void *ShaCtor(const uint32_t *init, int words,
+    void (*blocks)(uint32_t*, const uint8_t*, int64_t))
+{
+  struct Sha *ctx = g_malloc0(sizeof *ctx);
+
+  memcpy(ctx->state, init, words * sizeof *init);
+  ctx->words = words;
+  ctx->blocks = blocks;
+  return ctx;
+}
+
+static void *Sha1Ctor()
+{
+  return ShaCtor(SHA1_INIT, G_N_ELEMENTS(SHA1_INIT), Sha1Blocks);
+}
+
+static void *Sha256Ctor()
+{
+  return ShaCtor(SHA256_INIT, G_N_ELEMENTS(SHA256_INIT), Sha256Blocks);
+}
+
+static void ShaUpdate(void *ctx, const char *buffer, int64_t size)
+{
+  struct Sha *sha = ctx;
+  const uint8_t *data = (const uint8_t*)buffer;
+  int64_t blocks;
+
+  sha->length += size;
+
+  /* complete the incomplete block */
+  if(sha->used > 0)
+  {
+    int take = MIN(size, SHA_BLOCK - sha->used);
+
+    memcpy(sha->block + sha->used, data, take);
+    sha->used += take;
+    data += take;
+    size -= take;
+    if(sha->used < SHA_BLOCK) return;
+    sha->blocks(sha->state, sha->block, 1);
+    sha->used = 0;
+  }
+
+  /* the whole blocks are hashed right from the buffer */
+  blocks = size / SHA_BLOCK;
+  if(blocks > 0) sha->blocks(sha->state, data, blocks);
+  data += blocks * SHA_BLOCK;
+  size -= blocks * SHA_BLOCK;
+
+  memcpy(sha->block, data, size);
+  sha->used = size;
+}
+
+static void ShaDigest(void *ctx, char *digest)
+{
+  struct Sha tmp = *(struct Sha*)ctx;
+  uint64_t bits = tmp.length * 8;
+  uint8_t tail[2 * SHA_BLOCK] = {0};
+  int size;
+  int i;
+
+  /* the padding and the big endian length in bits */
+  memcpy(tail, tmp.block, tmp.used);
+  tail[tmp.used] = 0x80;
+  size = tmp.used + 9 > SHA_BLOCK ? 2 * SHA_BLOCK : SHA_BLOCK;
+  for(i = 0; i < 8; ++i)
+    tail[size - 1 - i] = bits >> (8 * i);
+  tmp.blocks(tmp.state, tail, size / SHA_BLOCK);
+
+  for(i = 0; i < tmp.words; ++i)
+    sprintf(digest + 8 * i, "%08x", tmp.state[i]);
+}
+
+static void ShaDtor(void *ctx)
+{
+  g_free(ctx);
+}
+
+/* return not 0 if the cpu has the sha extensions */
+static int ShaSupported()
+{
+  unsigned a, b, c, d;
+
+  if(__get_cpuid(1, &a, &b, &c, &d) == 0) return 0;
+  if(!(c & bit_SSSE3) || !(c & bit_SSE4_1)) return 0;
+  if(__get_cpuid_max(0, NULL) < 7) return 0;
+  __cpuid_count(7, 0, a, b, c, d);
+  return (b & CPUID_SHA) != 0;
+}
+/* }} */
+
+/* xxh64 engine {{ */
+#define XXH_PRIME1 0x9e3779b185ebca87ULL
+#define XXH_PRIME2 0xc2b2ae3d27d4eb4fULL
+#define XXH_PRIME3 0x165667b19e3779f9ULL
+#define XXH_PRIME4 0x85ebca77c2b2ae63ULL
+#define XXH_PRIME5 0x27d4eb2f165667c5ULL
+
+static INLINE uint64_t XxhRound(uint64_t acc, uint64_t input)
+{
+  acc += input * XXH_PRIME2;
+  acc = ROTL64(acc, 31);
+  return acc * XXH_PRIME1;
+}
+
+static INLINE uint64_t XxhMerge(uint64_t acc, uint64_t v)
+{
+  acc ^= XxhRound(0, v);
+  return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+static INLINE uint64_t Read64(const uint8_t *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+static INLINE uint32_t Read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+/* hash the whole stripes. return the hashed size */
+static int64_t XxhStripes(uint64_t *v, const uint8_t *data, int64_t size)
+{
+  uint64_t v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+  const uint8_t *p = data;
+
+  /* 4 independent lanes */
+  for(; size >= XXH_STRIPE; size -= XXH_STRIPE, p += XXH_STRIPE)
+  {
+    v0 = XxhRound(v0, Read64(p));
+    v1 = XxhRound(v1, Read64(p + 8));
+    v2 = XxhRound(v2, Read64(p + 16));
+    v3 = XxhRound(v3, Read64(p + 24));
+  }
+
+  v[0] = v0;
+  v[1] = v1;
+  v[2] = v2;
+  v[3] = v3;
+  return p - data;
+}
+
+static void *Xxh64Ctor()
+{
+  struct Xxh64 *ctx = g_malloc0(sizeof *ctx);
+
+  ctx->v[0] = XXH_PRIME1 + XXH_PRIME2;
+  ctx->v[1] = XXH_PRIME2;
+  ctx->v[2] = 0;
+  ctx->v[3] = -XXH_PRIME1;
+  return ctx;
+}
+
+static void Xxh64Update(void *ctx, const char *buffer, int64_t size)
+{
+  struct Xxh64 *xxh = ctx;
+  const uint8_t *data = (const uint8_t*)buffer;
+  int64_t done;
+
+  xxh->length += size;
+
+  /* complete the incomplete stripe */
+  if(xxh->used > 0)
+  {
+    int take = MIN(size, XXH_STRIPE - xxh->used);
+
+    memcpy(xxh->stripe + xxh->used, data, take);
+    xxh->used += take;
+    data += take;
+    size -= take;
+    if(xxh->used < XXH_STRIPE) return;
+    XxhStripes(xxh->v, xxh->stripe, XXH_STRIPE);
+    xxh->used = 0;
+  }
+
+  done = XxhStripes(xxh->v, data, size);
+  memcpy(xxh->stripe, data + done, size - done);
+  xxh->used = size - done;
+}
+
+static void Xxh64Digest(void *ctx, char *digest)
+{
+  const struct Xxh64 *xxh = ctx;
+  const uint8_t *p = xxh->stripe;
+  int rest = xxh->used;
+  uint64_t h;
+
+  if(xxh->length >= XXH_STRIPE)
+  {
+    h = ROTL64(xxh->v[0], 1) + ROTL64(xxh->v[1], 7)
+        + ROTL64(xxh->v[2], 12) + ROTL64(xxh->v[3], 18);
+    h = XxhMerge(h, xxh->v[0]);
+    h = XxhMerge(h, xxh->v[1]);
+    h = XxhMerge(h, xxh->v[2]);
+    h = XxhMerge(h, xxh->v[3]);
+  }
+  else
+    h = XXH_PRIME5;
+  h += xxh->length;
+
+  /* the tail */
+  for(; rest >= 8; rest -= 8, p += 8)
+  {
+    h ^= XxhRound(0, Read64(p));
+    h = ROTL64(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+  }
+  if(rest >= 4)
+  {
+    h ^= Read32(p) * XXH_PRIME1;
+    h = ROTL64(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+    rest -= 4;
+    p += 4;
+  }
+  for(; rest > 0; --rest, ++p)
+  {
+    h ^= *p * XXH_PRIME5;
+    h = ROTL64(h, 11) * XXH_PRIME1;
+  }
+
+  /* avalanche */
+  h ^= h >> 33;
+  h *= XXH_PRIME2;
+  h ^= h >> 29;
+  h *= XXH_PRIME3;
+  h ^= h >> 32;
+
+  sprintf(digest, "%016lx", (unsigned long)h);
+}
+
+static void Xxh64Dtor(void *ctx)
+{
+  g_free(ctx);
+}
+/* }} */
+
+/* tree engine {{ */
+/* hash the data with the leaves engine */
+static void Hash(const char *data, int64_t size, char *digest)
+{
+  void *ctx = base->ctor();
+
+  memset(digest, 0, TAG_DIGEST_SIZE);
+  if(size > 0) base->update(ctx, data, size);
+  base->digest(ctx, digest);
+  base->dtor(ctx);
+}
+
+/* the thread pool worker */
+static void RunJob(gpointer data, gpointer user_data)
+{
+  struct Job *job = data;
+  job->run(job);
+}
+
+static void HashLeaf(struct Job *job)
+{
+  struct Leaf *leaf = (struct Leaf*)job;
+  struct Tree *tree = leaf->tree;
+  char digest[TAG_DIGEST_SIZE];
+
+  Hash(leaf->data, leaf->size, digest);
+
+  g_mutex_lock(&tree->lock);
+  memcpy(tree->digests[leaf->index], digest, TAG_DIGEST_SIZE);
+  --tree->pending;
+  g_cond_signal(&tree->done);
+  g_mutex_unlock(&tree->lock);
+
+  g_free(leaf->data);
+  g_free(leaf);
+}
+
+/* give the full current leaf to the thread pool */
+static void Submit(struct Tree *tree)
+{
+  struct Leaf *leaf = g_malloc(sizeof *leaf);
+
+  g_mutex_lock(&tree->lock);
+
+  /* the hashing is too far behind. wait for the workers */
+  while(tree->pending >= pending_max)
+    g_cond_wait(&tree->done, &tree->lock);
+
+  if(tree->count == tree->capacity)
+  {
+    tree->capacity = MAX(16, 2 * tree->capacity);
+    tree->digests = g_realloc(tree->digests, tree->capacity * sizeof *tree->digests);
+  }
+  leaf->job.run = HashLeaf;
+  leaf->tree = tree;
+  leaf->index = tree->count++;
+  leaf->data = tree->leaf;
+  leaf->size = tree->used;
+  ++tree->pending;
+  g_mutex_unlock(&tree->lock);
+
+  g_thread_pool_push(pool, leaf, NULL);
+  tree->leaf = g_malloc(leaf_size);
+  tree->used = 0;
+}
+
+static void *TreeCtor()
+{
+  struct Tree *tree = g_malloc0(sizeof *tree);
+
+  g_mutex_init(&tree->lock);
+  g_cond_init(&tree->done);
+  tree->leaf = g_malloc(leaf_size);
+  return tree;
+}
+
+static void TreeUpdate(void *ctx, const char *buffer, int64_t size)
+{
+  struct Tree *tree = ctx;
+
+  /* the data is copied, the user can change the buffer after the call */
+  while(size > 0)
+  {
+    int64_t take = MIN(size, leaf_size - tree->used);
+
+    memcpy(tree->leaf + tree->used, buffer, take);
+    tree->used += take;
+    buffer += take;
+    size -= take;
+    if(tree->used == leaf_size) Submit(tree);
+  }
+}
+
+/* wait until all submitted leaves hashed */
+static void Wait(struct Tree *tree)
+{
+  g_mutex_lock(&tree->lock);
+  while(tree->pending > 0)
+    g_cond_wait(&tree->done, &tree->lock);
+  g_mutex_unlock(&tree->lock);
+}
+
+/*
+ * put the root of the tree over "count" (> 0) leaves digests to "digest".
+ * the node is the hash of the children digests, the odd one goes up.
+ * "level" is destroyed
+ */
+static void Root(char (*level)[TAG_DIGEST_SIZE], int64_t count, char *digest)
+{
+  int64_t i;
+
+  for(; count > 1; count = (count + 1) / 2)
+    for(i = 0; i < count; i += 2)
+    {
+      char pair[2 * sizeof *level];
+      int left = strlen(level[i]);
+      int right;
+
+      if(i + 1 == count)
+      {
+        memcpy(level[i / 2], level[i], TAG_DIGEST_SIZE);
+        continue;
+      }
+      right = strlen(level[i + 1]);
+      memcpy(pair, level[i], left);
+      memcpy(pair + left, level[i + 1], right);
+      Hash(pair, left + right, level[i / 2]);
+    }
+
+  strcpy(digest, level[0]);
+}
+
+static void TreeDigest(void *ctx, char *digest)
+{
+  struct Tree *tree = ctx;
+  char (*level)[TAG_DIGEST_SIZE];
+  int64_t count = tree->count;
+
+  Wait(tree);
+
+  /* the last incomplete leaf (or the empty stream) */
+  level = g_malloc0((count + 1) * sizeof *level);
+  memcpy(level, tree->digests, count * sizeof *level);
+  if(tree->used > 0 || count == 0)
+    Hash(tree->leaf, tree->used, level[count++]);
+
+  Root(level, count, digest);
+  g_free(level);
+}
+
+static void TreeDtor(void *ctx)
+{
+  struct Tree *tree = ctx;
+
+  Wait(tree);
+  g_mutex_clear(&tree->lock);
+  g_cond_clear(&tree->done);
+  g_free(tree->digests);
+  g_free(tree->leaf);
+  g_free(tree);
+}
+
+static const struct Engine tree_engine =
+  {"tree", TreeCtor, TreeUpdate, TreeDigest, TreeDtor};
+
+static void PoolCtor()
+{
+  pool = ThreadPoolCtor(RunJob, 0);
+  pending_max = 2 * g_thread_pool_get_max_threads(pool);
+  ZLOGS(LOG_DEBUG, "etag thread pool of %d threads", pending_max / 2);
+}
+/* }} */
+
+/* memory pages {{ */
+/* the memory pages hashing */
+struct Pages
+{
+  GMutex lock;
+  GCond done; /* a span hashed */
+  int pending; /* the spans being hashed */
+  const char **addrs;
+  int64_t *sizes;
+  char *untouched; /* the page was never touched (reads as zeroes) */
+  char (*digests)[TAG_DIGEST_SIZE];
+};
+
+/* the pages span job of the thread pool */
+struct Span
+{
+  struct Job job;
+  struct Pages *pages;
+  int64_t first;
+  int64_t last;
+};
+
+static char zero_digest[TAG_DIGEST_SIZE]; /* the digest of the zero page */
+
+/* return not 0 if the page contains zeroes only */
+static int IsZero(const char *addr, int64_t size)
+{
+  const uint64_t *p = (const uint64_t*)addr;
+  uint64_t acc = 0;
+  int64_t i;
+
+  for(i = 0; i < size / (int64_t)sizeof *p; ++i)
+  {
+    acc |= p[i];
+    if((i & 0x1ff) == 0x1ff && acc != 0) return 0;
+  }
+  return acc == 0;
+}
+
+static void HashSpan(struct Job *job)
+{
+  struct Span *span = (struct Span*)job;
+  struct Pages *pages = span->pages;
+  int64_t i;
+
+  for(i = span->first; i < span->last; ++i)
+  {
+    if(pages->sizes[i] == TAG_PAGE_SIZE
+        && (pages->untouched[i] || IsZero(pages->addrs[i], TAG_PAGE_SIZE)))
+      memcpy(pages->digests[i], zero_digest, TAG_DIGEST_SIZE);
+    else
+      Hash(pages->addrs[i], pages->sizes[i], pages->digests[i]);
+  }
+
+  g_mutex_lock(&pages->lock);
+  --pages->pending;
+  g_cond_signal(&pages->done);
+  g_mutex_unlock(&pages->lock);
+}
+
+/*
+ * mark the untouched pages of the region starting from "index": neither
+ * present, nor swapped, nor file backed system pages. if the pagemap is
+ * not available all pages are treated as touched
+ */
+static void Untouched(int fd, const char *addr, int64_t size,
+    struct Pages *pages, int64_t index)
+{
+  uint64_t entries[TAG_PAGE_SIZE / 0x1000];
+  int64_t system = sysconf(_SC_PAGESIZE);
+  int64_t count = MIN(TAG_PAGE_SIZE / system, (int64_t)G_N_ELEMENTS(entries));
+  int64_t offset;
+  int64_t i;
+
+  if(fd < 0 || TAG_PAGE_SIZE % system != 0) return;
+  for(offset = 0; offset + TAG_PAGE_SIZE <= size; offset += TAG_PAGE_SIZE)
+  {
+    uint64_t flags = 0;
+    int64_t pos = (uintptr_t)(addr + offset) / system * sizeof *entries;
+
+    if(pread(fd, entries, count * sizeof *entries, pos)
+        != count * (int64_t)sizeof *entries) return;
+    for(i = 0; i < count; ++i)
+      flags |= entries[i];
+    pages->untouched[index + offset / TAG_PAGE_SIZE] = (flags & PAGEMAP_USED) == 0;
+  }
+}
+
+void TagPagesDigest(const uintptr_t *starts, const int64_t *sizes,
+    int count, char *digest)
+{
+  struct Pages pages;
+  struct Span *spans;
+  int64_t total = 0;
+  int64_t spans_count;
+  int64_t i;
+  int fd;
+
+  assert(starts != NULL);
+  assert(sizes != NULL);
+  assert(digest != NULL);
+
+  if(engine == NULL) TagEngineCtor(NULL, 0);
+  if(pool == NULL) PoolCtor();
+
+  /* the zero page digest */
+  if(*zero_digest == 0)
+  {
+    char *zero = g_malloc0(TAG_PAGE_SIZE);
+    Hash(zero, TAG_PAGE_SIZE, zero_digest);
+    g_free(zero);
+  }
+
+  /* cut the regions to the pages */
+  for(i = 0; i < count; ++i)
+    total += (sizes[i] + TAG_PAGE_SIZE - 1) / TAG_PAGE_SIZE;
+  memset(&pages, 0, sizeof pages);
+  pages.addrs = g_malloc(MAX(1, total) * sizeof *pages.addrs);
+  pages.sizes = g_malloc(MAX(1, total) * sizeof *pages.sizes);
+  pages.untouched = g_malloc0(MAX(1, total));
+  pages.digests = g_malloc0(MAX(1, total) * sizeof *pages.digests);
+
+  fd = open(PAGEMAP, O_RDONLY);
+  ZLOGIF(fd < 0, "cannot open %s, all pages will be hashed", PAGEMAP);
+  for(total = 0, i = 0; i < count; ++i)
+  {
+    int64_t offset;
+
+    Untouched(fd, (const char*)starts[i], sizes[i], &pages, total);
+    for(offset = 0; offset < sizes[i]; offset += TAG_PAGE_SIZE, ++total)
+    {
+      pages.addrs[total] = (const char*)starts[i] + offset;
+      pages.sizes[total] = MIN(TAG_PAGE_SIZE, sizes[i] - offset);
+    }
+  }
+  if(fd >= 0) close(fd);
+
+  /* hash the pages spans in parallel */
+  g_mutex_init(&pages.lock);
+  g_cond_init(&pages.done);
+  spans_count = (total + TAG_SPAN_PAGES - 1) / TAG_SPAN_PAGES;
+  spans = g_malloc(MAX(1, spans_count) * sizeof *spans);
+  pages.pending = spans_count;
+  for(i = 0; i < spans_count; ++i)
+  {
+    spans[i].job.run = HashSpan;
+    spans[i].pages = &pages;
+    spans[i].first = i * TAG_SPAN_PAGES;
+    spans[i].last = MIN(total, (i + 1) * TAG_SPAN_PAGES);
+    g_thread_pool_push(pool, &spans[i], NULL);
+  }
+
+  g_mutex_lock(&pages.lock);
+  while(pages.pending > 0)
+    g_cond_wait(&pages.done, &pages.lock);
+  g_mutex_unlock(&pages.lock);
+
+  /* no memory is the empty page */
+  if(total == 0) Hash(NULL, 0, pages.digests[total++]);
+  Root(pages.digests, total, digest);
+
+  g_mutex_clear(&pages.lock);
+  g_cond_clear(&pages.done);
+  g_free(spans);
+  g_free(pages.digests);
+  g_free(pages.untouched);
+  g_free(pages.sizes);
+  g_free(pages.addrs);
+}
+/* }} */
+
+static const struct Engine engines[] = {
+  {TAG_ENGINE_SHA1, GlibCtor, GlibUpdate, GlibDigest, GlibDtor},
+  {TAG_ENGINE_SHA256, GlibCtor, GlibUpdate, GlibDigest, GlibDtor},
+  {TAG_ENGINE_SHA1, Sha1Ctor, ShaUpdate, ShaDigest, ShaDtor},
+  {TAG_ENGINE_SHA256, Sha256Ctor, ShaUpdate, ShaDigest, ShaDtor},
+  {TAG_ENGINE_XXH64, Xxh64Ctor, Xxh64Update, Xxh64Digest, Xxh64Dtor}
+};
+
+void TagEngineCtor(const char *name, int64_t leaf)
+{
+  int sha = ShaSupported();
+  int i;
+
+  if(name == NULL) name = TAG_ENGINE_DEFAULT;
+
+  /* the sha extensions engines go after the glib ones */
+  for(i = G_N_ELEMENTS(engines) - 1; i >= 0; --i)
+  {
+    if(!STREQ(engines[i].name, name)) continue;
+    if(engines[i].ctor == Sha1Ctor || engines[i].ctor == Sha256Ctor)
+      if(!sha) continue;
+    break;
+  }
+  ZLOGFAIL(i < 0, EFAULT, "unknown etag engine %s", name);
+
+  engine = &engines[i];
+  checksum = STREQ(name, TAG_ENGINE_SHA256) ? G_CHECKSUM_SHA256 : G_CHECKSUM_SHA1;
+  ZLOGS(LOG_DEBUG, "etag engine %s (%s)", name,
+      engine->ctor == GlibCtor ? "glib" : "native");
+
+  /* the tree hashing */
+  ZLOGFAIL(leaf < 0, EFAULT, "invalid etag leaf size");
+  base = engine;
+  if(leaf == 0) return;
+  ZLOGS(LOG_DEBUG, "etag tree of %ld bytes leaves", leaf);
+  engine = &tree_engine;
+  leaf_size = leaf;
+  if(pool == NULL) PoolCtor();
+}
+
 void *TagCtor()
 {
-  GChecksum *ctx;
+  void *ctx;
 
-  ctx = g_checksum_new(TAG_ENCRYPTION);
+  if(engine == NULL) TagEngineCtor(NULL, 0);
+  ctx = engine->ctor();
   ZLOGFAIL(ctx == NULL, EFAULT, "error initializing tag context");
   return ctx;
 }
 
 void TagDtor(void *ctx)
 {
-  g_checksum_free(ctx);
+  engine->dtor(ctx);
 }
 
 void TagDigest(void *ctx, char *digest)
 {
-  const char *hex;
-  GChecksum *tmp;
-
-  tmp = g_checksum_copy(ctx);
-  hex = g_checksum_get_string(tmp);
-  strcpy(digest, hex);
-  g_checksum_free(tmp);
+  memset(digest, 0, TAG_DIGEST_SIZE);
+  engine->digest(ctx, digest);
 }
 
 void TagUpdate(void *ctx, const char *buffer, int64_t size)
@@ -56,5 +935,5 @@ void TagUpdate(void *ctx, const char *buffer, int64_t size)
 
   /* update the context with a new data */
   if(size > 0)
-    g_checksum_update(ctx, (const guchar*)buffer, size);
+    engine->update(ctx, buffer, size);
 }
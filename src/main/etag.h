@@ -21,10 +21,31 @@
 
 #include <stdint.h>
 
-/* G_CHECKSUM_MD5, G_CHECKSUM_SHA1, G_CHECKSUM_SHA256 */
-#define TAG_ENCRYPTION G_CHECKSUM_SHA1
-#define TAG_DIGEST_SIZE 40 + 1 /* without '\0': 32, 40, 64 */
+/* hash engines (manifest "Etag" key) */
+#define TAG_ENGINE_SHA1 "sha1"
+#define TAG_ENGINE_SHA256 "sha256"
+#define TAG_ENGINE_XXH64 "xxh64" /* fast, non-cryptographic */
+#define TAG_ENGINE_DEFAULT TAG_ENGINE_SHA1
+#define TAG_DIGEST_SIZE 64 + 1 /* without '\0': 40, 64, 16. zero padded */
 #define TAG_ENGINE_DISABLED "disabled"
+#define TAG_PAGE_SIZE 0x10000 /* the memory etag page */
+
+/*
+ * select the hash engine by name (NULL - default) or abort if unknown.
+ * "leaf" > 0 turns on the tree mode: the stream is cut to the leaves of
+ * "leaf" bytes hashed in parallel, the digest is the merkle tree root.
+ * should be called before the first context constructed
+ */
+void TagEngineCtor(const char *name, int64_t leaf);
+
+/*
+ * put the digest of the memory regions "starts"/"sizes" to "digest". the
+ * regions are cut to TAG_PAGE_SIZE pages hashed in parallel, the pages
+ * never touched or filled with zeroes take the precomputed digest. the
+ * digest is the root of the pages tree (see the tree mode)
+ */
+void TagPagesDigest(const uintptr_t *starts, const int64_t *sizes,
+    int count, char *digest);
 
 /*
  * initialize and return the hash context or abort if failed
@@ -37,7 +58,7 @@ void TagDtor(void *ctx);
 
 /*
  * calculates digest from the context. can be used consequently
- * note: "digest" must have enough space to hold the digest
+ * note: "digest" must have TAG_DIGEST_SIZE bytes, the rest is zeroed
  */
 void TagDigest(void *ctx, char *digest);
 
@@ -145,6 +145,32 @@ int GetValuesByKey(const char *key, char *values[], int capacity)
   return count;
 }
 
+char *GetValueByAlias(const char *key, const char *alias)
+{
+  static char value[BIG_ENOUGH_STRING];
+  int i;
+
+  /* check for a design error */
+  assert(key != NULL);
+  assert(alias != NULL);
+  assert(mft_ptr != NULL);
+  assert(mft_count > 0);
+
+  for(i = 0; i < mft_count; ++i)
+  {
+    char *token;
+
+    if(strcmp(key, mft_ptr[i].key) != 0) continue;
+
+    /* the 1st field is cut in the copy, the whole value is copied again */
+    g_strlcpy(value, mft_ptr[i].value, BIG_ENOUGH_STRING);
+    if(ParseValue(value, ",", &token, 1) == 0 || !STREQ(token, alias)) continue;
+    g_strlcpy(value, mft_ptr[i].value, BIG_ENOUGH_STRING);
+    return value;
+  }
+  return NULL;
+}
+
 int ParseValue(char *value, const char *delimiter, char *tokens[], int capacity)
 {
   int count;
@@ -44,6 +44,14 @@ char* GetValueByKey(const char *key);
  */
 int GetValuesByKey(const char *key, char *values[], int capacity);
 
+/*
+ * get the copy of the value by key whose 1st comma separated field is
+ * the given alias (the manifest value stays intact for the other
+ * channels). NULL if not found
+ * note: function is not re-enterable; the copy will be overwritten
+ */
+char *GetValueByAlias(const char *key, const char *alias);
+
 /*
  * parse given string with the given delimiter removing leading/traling spaces
  * return number of the tokens, populate given array with them
@@ -19,8 +19,10 @@
 /* todo(d'b): should merge into sel_addrspace, sel_ldr, nacl_exit e.t.c. */
 #include <assert.h>
 #include <time.h>
+#include <sched.h>
 #include <sys/resource.h> /* timeout, process priority */
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <glib.h>
 #include "src/loader/sel_ldr.h"
 #include "src/main/etag.h"
@@ -41,6 +43,24 @@
 /* hard limit for all zerovm i/o */
 static int64_t storage_limit = ZEROVM_IO_LIMIT;
 
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23 /* linux 5.14 */
+#endif
+
+/* numa memory policies (see set_mempolicy(2)) */
+#define MPOL_PREFERRED 1
+#define MPOL_BIND 2
+
+/* the heap end limit (user address). the heap grows up to it */
+static uintptr_t heap_cap = 0;
+
+/* the pinned cpus list ("Affinity" normalized) */
+static char affinity[BIG_ENOUGH_STRING];
+
+/* the memory digest calculated in background at exit */
+static GThreadPool *mem_digester = NULL;
+static char mem_digest[TAG_DIGEST_SIZE];
+
 /* limit zerovm i/o */
 static void LimitOwnIO()
 {
@@ -95,11 +115,108 @@ void LastDefenseLine(struct NaClApp *nap)
   GiveUpPrivileges();
 }
 
+/*
+ * back the 2mb aligned part of the region with the transparent huge
+ * pages. the kernel without thp keeps the small pages
+ */
+static void AdviseHugePages(uintptr_t start, int64_t size, const char *name)
+{
+  uintptr_t begin = ROUNDUP_2M(start);
+  uintptr_t end = ROUNDDOWN_2M(start + size);
+  int i;
+
+  if(end <= begin) return;
+  i = NaCl_madvise((void*)begin, end - begin, MADV_HUGEPAGE);
+  ZLOGIF(i != 0, "cannot use huge pages for %s: %s", name, strerror(-i));
+  if(i == 0)
+    ZLOGS(LOG_DEBUG, "%s has %ld huge pages", name,
+        (int64_t)((end - begin) / HUGE_PAGE_SIZE));
+}
+
+/* bind the region to the numa node */
+static void BindMemory(uintptr_t start, int64_t size, int node, const char *name)
+{
+  unsigned long mask[NUMA_NODES_MAX / (8 * sizeof(unsigned long))] = {0};
+
+  mask[node / (8 * sizeof *mask)] = 1UL << node % (8 * sizeof *mask);
+  ZLOGFAIL(syscall(SYS_mbind, start, size, MPOL_BIND,
+      mask, NUMA_NODES_MAX + 1, 0) != 0, errno,
+      "cannot bind %s to numa node %d", name, node);
+}
+
+/*
+ * fault the heap in advance by "Prefault = none|all|<bytes>" (from the
+ * heap start). the old kernels get the pages touched one by one
+ */
+static void PrefaultHeap(uintptr_t start, int64_t heap)
+{
+  char *value = GetValueByKey(MFT_PREFAULT);
+  struct rusage before, after;
+  int64_t size;
+  int i;
+
+  if(value == NULL || STREQ(value, PREFAULT_NONE)) return;
+  size = STREQ(value, PREFAULT_ALL) ? heap : ATOI(value);
+  ZLOGFAIL(size <= 0, EFAULT, "Prefault has invalid value %s", value);
+  size = MIN(heap, (int64_t)ROUNDUP_4K(size));
+
+  memset(&before, 0, sizeof before);
+  after = before;
+  getrusage(RUSAGE_SELF, &before);
+  i = NaCl_madvise((void*)start, size, MADV_POPULATE_WRITE);
+  if(i == -EINVAL)
+  {
+    volatile char *page;
+    for(page = (char*)start; page < (char*)start + size; page += NACL_PAGESIZE)
+      *page = 0;
+    i = 0;
+  }
+  ZLOGFAIL(i != 0, -i, "cannot prefault %ld bytes of user heap", size);
+  getrusage(RUSAGE_SELF, &after);
+  ZLOGS(LOG_DEBUG, "%ld bytes of user heap prefaulted with %ld page faults",
+      size, after.ru_minflt - before.ru_minflt + after.ru_majflt - before.ru_majflt);
+}
+
+/* let the kernel (ksm) merge the region pages equal to other sessions ones */
+static void AdviseMergeable(uintptr_t start, int64_t size, const char *name)
+{
+  int i;
+  uintptr_t page = ROUNDDOWN_4K(start);
+
+  size += start - page;
+  if(size <= 0) return;
+  i = NaCl_madvise((void*)page, size, MADV_MERGEABLE);
+  ZLOGIF(i != 0, "cannot make %s mergeable: %s", name, strerror(-i));
+}
+
+/*
+ * "Dedup = 0|1|2": the user memory pages shared with the other sessions
+ * of the same nexe (1 - text and rodata, 2 - the heap too). should be
+ * called after the heap is set
+ */
+static void DedupUserMemory(struct NaClApp *nap)
+{
+  int64_t level;
+
+  level = ATOI(GetValueByKey(MFT_DEDUP));
+  ZLOGFAIL(level < 0 || level > DEDUP_HEAP, EFAULT, "Dedup has invalid value");
+  if(level == 0) return;
+
+  AdviseMergeable(nap->mem_map[TextIdx].start, nap->mem_map[TextIdx].size, "text");
+  AdviseMergeable(nap->mem_map[RODataIdx].start, nap->mem_map[RODataIdx].size, "rodata");
+  if(level == DEDUP_HEAP && nap->mem_map[HeapIdx].start != 0)
+    AdviseMergeable(nap->mem_map[HeapIdx].start,
+        NaClUserToSys(nap, heap_cap) - nap->mem_map[HeapIdx].start, "heap");
+  ZLOGS(LOG_DEBUG, "user memory dedup level %ld", level);
+}
+
 /* preallocate memory area of given size. abort if fail */
 static void PreallocateUserMemory(struct NaClApp *nap)
 {
   uintptr_t i;
   int64_t heap;
+  int64_t open;
+  char *initial;
   void *p;
 
   assert(nap != NULL);
@@ -115,14 +232,43 @@ static void PreallocateUserMemory(struct NaClApp *nap)
   heap = ROUNDUP_64K(heap) - ROUNDUP_64K(nap->data_end);
   ZLOGFAIL(heap <= LEAST_USER_HEAP_SIZE, ENOMEM, "user heap size is too small");
 
+  /* "Heap" opens the part of the heap, the rest is given by the trap */
+  open = heap;
+  initial = GetValueByKey(MFT_HEAP);
+  if(initial != NULL)
+  {
+    ZLOGFAIL(ATOI(initial) <= 0, EFAULT, "Heap has invalid size %s", initial);
+    open = MIN(heap, (int64_t)ROUNDUP_64K(ATOI(initial)));
+  }
+
   /* since 4gb of user space is already allocated just set protection to the heap */
   p = (void*)NaClUserToSys(nap, (uintptr_t)p);
-  i = NaCl_mprotect(p, heap, PROT_READ | PROT_WRITE);
+  i = NaCl_mprotect(p, open, PROT_READ | PROT_WRITE);
   ZLOGFAIL(0 != i, -i, "cannot set protection on user heap");
-  nap->heap_end = NaClSysToUser(nap, (uintptr_t)p + heap);
+  nap->heap_end = NaClSysToUser(nap, (uintptr_t)p + open);
+  heap_cap = NaClSysToUser(nap, (uintptr_t)p + heap);
 
-  nap->mem_map[HeapIdx].size += heap;
-  nap->mem_map[HeapIdx].end += heap;
+  nap->mem_map[HeapIdx].size += open;
+  nap->mem_map[HeapIdx].end += open;
+
+  /* the numa node of the user memory */
+  if(nap->system_manifest->numa >= 0)
+  {
+    BindMemory((uintptr_t)p, heap, nap->system_manifest->numa, "heap");
+    BindMemory(nap->mem_map[StackIdx].start, nap->mem_map[StackIdx].size,
+        nap->system_manifest->numa, "stack");
+  }
+
+  /* the layout does not change, only the pages backing */
+  if(nap->huge_pages)
+  {
+    AdviseHugePages((uintptr_t)p, heap, "heap");
+    AdviseHugePages(nap->mem_map[StackIdx].start,
+        nap->mem_map[StackIdx].size, "stack");
+  }
+
+  /* the last: the pages get the numa node and the size chosen above */
+  PrefaultHeap((uintptr_t)p, open);
 }
 
 /* todo(d'b): move it to sel_addrspace */
@@ -149,6 +295,9 @@ struct UserManifestSerialized
 #define CHANNEL_STRUCT_SIZE sizeof(struct ChannelSerialized)
 #define USER_MANIFEST_STRUCT_SIZE sizeof(struct UserManifestSerialized)
 
+/* the heap size in the user manifest (system address) */
+static uint32_t *heap_size = NULL;
+
 /* set pointer to user manifest */
 static void SetUserManifestPtr(struct NaClApp *nap, void *mft)
 {
@@ -272,7 +421,9 @@ static void SetSystemData(struct NaClApp *nap)
 
   /* update heap_size in the user manifest */
   size = ROUNDDOWN_64K(NaClSysToUser(nap, (uintptr_t)ptr));
+  heap_cap = MIN(heap_cap, size);
   size = MIN(nap->heap_end, size);
+  nap->heap_end = size;
   user_manifest->heap_size = size - nap->break_addr;
 
   /* note that rw data merged with heap! */
@@ -289,22 +440,151 @@ static void SetSystemData(struct NaClApp *nap)
 
   /* make the user manifest read only */
   ProtectUserManifest(nap, ptr);
+  heap_size = &user_manifest->heap_size;
 }
 /* }} */
 
+int32_t GrowUserHeap(struct NaClApp *nap, uint32_t size)
+{
+  uintptr_t end;
+  uintptr_t page;
+  int i;
+
+  assert(nap != NULL);
+  assert(heap_size != NULL);
+
+  /* the heap does not shrink */
+  end = ROUNDUP_64K((uint64_t)nap->break_addr + size);
+  if(end <= nap->heap_end) return 0;
+  if(end > heap_cap) return -ENOMEM;
+
+  i = NaCl_mprotect((void*)NaClUserToSys(nap, nap->heap_end),
+      end - nap->heap_end, PROT_READ | PROT_WRITE);
+  if(i != 0) return i;
+
+  /* the memory map: the heap takes the hole start */
+  nap->mem_map[HeapIdx].end = NaClUserToSys(nap, end);
+  nap->mem_map[HeapIdx].size =
+      nap->mem_map[HeapIdx].end - nap->mem_map[HeapIdx].start;
+  nap->mem_map[HoleIdx].start = nap->mem_map[HeapIdx].end;
+  nap->mem_map[HoleIdx].size =
+      nap->mem_map[HoleIdx].end - nap->mem_map[HoleIdx].start;
+  nap->heap_end = end;
+
+  /* the user manifest is read only for the user and for zerovm too */
+  page = ROUNDDOWN_4K((uintptr_t)heap_size);
+  i = NaCl_mprotect((void*)page, NACL_PAGESIZE, PROT_READ | PROT_WRITE);
+  ZLOGFAIL(i != 0, -i, "cannot update the user manifest");
+  *heap_size = end - nap->break_addr;
+  i = NaCl_mprotect((void*)page, NACL_PAGESIZE, PROT_READ);
+  ZLOGFAIL(i != 0, -i, "cannot protect the user manifest");
+
+  ZLOGS(LOG_DEBUG, "user heap grown to %u bytes", *heap_size);
+  return 0;
+}
+
 static void ParseMemoryArgs(struct NaClApp *nap)
 {
   char *tokens[MEMORY_ATTRIBUTES + 1];
   int i;
 
   i = ParseValue(GetValueByKey(MFT_MEMORY), ",", tokens, MEMORY_ATTRIBUTES + 1);
-  ZLOGFAIL(i != MEMORY_ATTRIBUTES, EFAULT,
+  ZLOGFAIL(i != MEMORY_ATTRIBUTES && i != MEMORY_ATTRIBUTES - 1, EFAULT,
       "Memory has invalid number of arguments");
   nap->heap_end = ATOI(tokens[0]);
 
+  nap->huge_pages = ATOI(tokens[2]);
+  ZLOGFAIL(nap->huge_pages != 0 && nap->huge_pages != 1, EFAULT,
+      "Memory has invalid huge pages argument");
+
   i = ATOI(tokens[1]);
-  ZLOGFAIL(i != 0 && i != 1, EFAULT, "Memory has invalid tag argument");
+  ZLOGFAIL(i < 0 || i > MEMORY_TAG_PAGES, EFAULT, "Memory has invalid tag argument");
   nap->mem_tag = i == 0 ? NULL : TagCtor();
+  nap->mem_tag_pages = i == MEMORY_TAG_PAGES;
+}
+
+/* set the etag engine from "Etag = engine[, leaf size]" */
+static void ParseEtagArgs(struct SystemManifest *policy)
+{
+  char *tokens[ETAG_ATTRIBUTES + 1];
+  int64_t leaf = 0;
+  int i;
+
+  i = ParseValue(GetValueByKey(MFT_ETAG), ",", tokens, ETAG_ATTRIBUTES + 1);
+  ZLOGFAIL(i > ETAG_ATTRIBUTES, EFAULT, "Etag has invalid number of arguments");
+  policy->etag = i > 0 ? tokens[0] : NULL;
+  if(i == ETAG_ATTRIBUTES)
+  {
+    leaf = ATOI(tokens[1]);
+    ZLOGFAIL(leaf < 0, EFAULT, "Etag has invalid leaf size");
+  }
+  TagEngineCtor(policy->etag, leaf);
+}
+
+/*
+ * pin zerovm to "Affinity = cpu[-cpu][+cpu[-cpu]...]". the threads
+ * created later (etag, network) inherit it
+ */
+static void SetAffinity(struct SystemManifest *policy)
+{
+  char *tokens[AFFINITY_RANGES_MAX + 1];
+  cpu_set_t set;
+  int count;
+  int i;
+
+  policy->affinity = NULL;
+  count = ParseValue(GetValueByKey(MFT_AFFINITY), "+", tokens, AFFINITY_RANGES_MAX + 1);
+  if(count == 0) return;
+  ZLOGFAIL(count > AFFINITY_RANGES_MAX, EFAULT, "Affinity has too many ranges");
+
+  CPU_ZERO(&set);
+  for(i = 0; i < count; ++i)
+  {
+    char *dash = strchr(tokens[i], '-');
+    int64_t first = ATOI(tokens[i]);
+    int64_t last = dash == NULL ? first : ATOI(dash + 1);
+
+    ZLOGFAIL(first < 0 || last < first || last >= CPU_SETSIZE, EFAULT,
+        "Affinity has invalid range %s", tokens[i]);
+    for(; first <= last; ++first)
+      CPU_SET(first, &set);
+  }
+  ZLOGFAIL(sched_setaffinity(0, sizeof set, &set) != 0, errno,
+      "cannot pin zerovm to cpus %s", GetValueByKey(MFT_AFFINITY));
+
+  /* the normalized list for the accounting */
+  for(i = 0; i < CPU_SETSIZE; ++i)
+  {
+    int first = i;
+    int length = strlen(affinity);
+
+    if(!CPU_ISSET(i, &set)) continue;
+    while(i + 1 < CPU_SETSIZE && CPU_ISSET(i + 1, &set)) ++i;
+    g_snprintf(affinity + length, BIG_ENOUGH_STRING - length,
+        first == i ? "%s%d" : "%s%d-%d", length > 0 ? "+" : "", first, i);
+  }
+  policy->affinity = affinity;
+  ZLOGS(LOG_DEBUG, "zerovm is pinned to cpus %s", affinity);
+}
+
+/*
+ * "Numa = node" binds the user memory to the node (see
+ * PreallocateUserMemory), zerovm own memory prefers it
+ */
+static void SetNuma(struct SystemManifest *policy)
+{
+  unsigned long mask[NUMA_NODES_MAX / (8 * sizeof(unsigned long))] = {0};
+  char *node = GetValueByKey(MFT_NUMA);
+
+  policy->numa = -1;
+  if(node == NULL) return;
+
+  policy->numa = ATOI(node);
+  ZLOGFAIL(policy->numa < 0 || policy->numa >= NUMA_NODES_MAX, EFAULT,
+      "Numa has invalid node %s", node);
+  mask[policy->numa / (8 * sizeof *mask)] = 1UL << policy->numa % (8 * sizeof *mask);
+  ZLOGFAIL(syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask,
+      NUMA_NODES_MAX + 1) != 0, errno, "cannot set numa node %d", policy->numa);
 }
 
 void SystemManifestCtor(struct NaClApp *nap)
@@ -317,7 +597,11 @@ void SystemManifestCtor(struct NaClApp *nap)
   assert(nap->system_manifest != NULL);
 
   policy = nap->system_manifest;
-  policy->etag = GetValueByKey(MFT_ETAG);
+
+  /* the placement goes first, all threads and allocations follow it */
+  SetAffinity(policy);
+  SetNuma(policy);
+  ParseEtagArgs(policy);
 
   /* set node id */
   node = GetValueByKey(MFT_NODE);
@@ -337,52 +621,87 @@ void SystemManifestCtor(struct NaClApp *nap)
    */
   ParseMemoryArgs(nap);
   PreallocateUserMemory(nap);
+  DedupUserMemory(nap);
 
   /* set user manifest in user space (new ZVM API) */
   SetSystemData(nap);
 }
 
-int SystemManifestDtor(struct NaClApp *nap)
-{
-  assert(nap != NULL);
-
-  ChannelsFinalizer(nap);
-  return 0;
-}
-
 /* populate given buffer with memory tag digest and free mem_tag */
 static void GetMemoryDigest(struct NaClApp *nap, char *digest)
 {
+  uintptr_t starts[MemMapSize];
+  int64_t sizes[MemMapSize];
+  int count;
   int i;
 
   assert(nap != NULL);
   assert(nap->mem_tag != NULL);
 
   /* calculate overall memory tag */
-  for(i = 0; i < MemMapSize; ++i)
+  for(i = 0, count = 0; i < MemMapSize; ++i)
   {
     uintptr_t addr = nap->mem_map[i].start;
     int64_t size = nap->mem_map[i].size;
 
     /* update user_etag skipping inaccessible pages */
-    if(nap->mem_map[i].prot & PROT_READ)
+    if(!(nap->mem_map[i].prot & PROT_READ)) continue;
+    if(nap->mem_tag_pages)
+    {
+      starts[count] = addr;
+      sizes[count++] = size;
+    }
+    else
       TagUpdate(nap->mem_tag, (const char*) addr, size);
   }
 
   /* get digest and destroy tag context */
-  TagDigest(nap->mem_tag, digest);
+  if(nap->mem_tag_pages)
+    TagPagesDigest(starts, sizes, count, digest);
+  else
+    TagDigest(nap->mem_tag, digest);
   TagDtor(nap->mem_tag);
   nap->mem_tag = NULL;
 }
 
+/* the background memory digest worker */
+static void DigestMemory(gpointer data, gpointer user_data)
+{
+  GetMemoryDigest(data, mem_digest);
+}
+
+int SystemManifestDtor(struct NaClApp *nap)
+{
+  assert(nap != NULL);
+
+  /* the user memory is final, hash it while the channels are closed */
+  if(nap->mem_tag != NULL && GetExitCode() == 0)
+  {
+    mem_digester = ThreadPoolCtor(DigestMemory, 1);
+    g_thread_pool_push(mem_digester, nap, NULL);
+  }
+
+  ChannelsFinalizer(nap);
+  return 0;
+}
+
 void ProxyReport(struct NaClApp *nap)
 {
   GString *report = g_string_sized_new(BIG_ENOUGH_STRING);
-  char mem_digest[TAG_DIGEST_SIZE];
+  int memory = mem_digester != NULL || nap->mem_tag != NULL;
 
   assert(nap != NULL);
   assert(nap->system_manifest != NULL);
 
+  /* wait for the memory digest or calculate it */
+  if(mem_digester != NULL)
+  {
+    g_thread_pool_free(mem_digester, FALSE, TRUE);
+    mem_digester = NULL;
+  }
+  else if(nap->mem_tag != NULL)
+    GetMemoryDigest(nap, mem_digest);
+
   /* create the report */
   g_string_append_printf(report, "%s%d\n", REPORT_VALIDATOR,
       nap->validation_state);
@@ -390,16 +709,12 @@ void ProxyReport(struct NaClApp *nap)
       nap->system_manifest->user_ret_code);
   g_string_append_printf(report, "%s", REPORT_ETAG);
 
-  if(nap->mem_tag == NULL
-      && (nap->channels_tag == NULL|| nap->channels_tag->len == 0))
+  if(!memory && (nap->channels_tag == NULL|| nap->channels_tag->len == 0))
     g_string_append_printf(report, "%s", TAG_ENGINE_DISABLED);
   else
   {
-    if(nap->mem_tag != NULL)
-    {
-      GetMemoryDigest(nap, mem_digest);
+    if(memory)
       g_string_append_printf(report, "%s ", mem_digest);
-    }
     if(nap->channels_tag->len > 0)
       g_string_append_printf(report, "%s", nap->channels_tag->str);
   }
@@ -49,7 +49,30 @@ EXTERN_C_BEGIN
 #define MFT_NAMESERVER "NameServer"
 #define MFT_NODE "Node"
 #define MFT_ETAG "Etag"
-#define MEMORY_ATTRIBUTES 2
+#define MFT_TRANSPORT "Transport"
+#define MFT_JOB "Job"
+#define MFT_CONNECT "Connect"
+#define MFT_GROUP "Group"
+#define MFT_PARTITION "Partition"
+#define MFT_MERGE "Merge"
+#define MFT_RECORD "Record"
+#define MFT_QUEUE "Queue"
+#define MFT_AFFINITY "Affinity"
+#define MFT_NUMA "Numa"
+#define MFT_PREFAULT "Prefault"
+#define MFT_HEAP "Heap"
+#define MFT_DEDUP "Dedup"
+#define MEMORY_ATTRIBUTES 3 /* size, etag, huge pages (optional) */
+#define MEMORY_TAG_PAGES 2 /* the memory etag per page */
+#define TRANSPORT_ATTRIBUTES 3
+#define ETAG_ATTRIBUTES 2 /* engine, leaf size */
+#define AFFINITY_RANGES_MAX 256 /* cpu ranges in "Affinity" */
+#define NUMA_NODES_MAX 1024
+#define PLACEMENT_ANY "any" /* accounting: the session is not pinned */
+#define PREFAULT_NONE "none" /* the user heap is faulted by the user */
+#define PREFAULT_ALL "all" /* the whole user heap is faulted in advance */
+#define DEDUP_CODE 1 /* text and rodata are mergeable */
+#define DEDUP_HEAP 2 /* and the heap (with r/w data) too */
 
 #ifdef DEBUG
 #define REPORT_VALIDATOR "validator state = "
@@ -73,7 +96,9 @@ struct SystemManifest
 
   /* nexe control */
   char *nexe; /* nexe file name */
-  char *etag; /* signature. reserved for a future */
+  char *etag; /* etag engine name */
+  char *affinity; /* the cpus the session is pinned to or NULL */
+  int numa; /* the user memory numa node or -1 */
   int32_t timeout; /* time user module allowed to run */
   int32_t user_ret_code; /* nexe return code */
 
@@ -106,6 +131,13 @@ int SystemManifestDtor(struct NaClApp *nap);
  */
 void ProxyReport(struct NaClApp *nap);
 
+/*
+ * grow the user heap to "size" bytes (64kb rounded) up to the "Memory"
+ * cap, update the memory map and the user manifest heap size. smaller
+ * size is ignored. return 0 or -errno
+ */
+int32_t GrowUserHeap(struct NaClApp *nap, uint32_t size);
+
 EXTERN_C_END
 
 #endif
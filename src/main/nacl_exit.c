@@ -66,16 +66,25 @@ static void FinalDump(struct NaClApp *nap)
  */
 static void Finalizer(void)
 {
+  AccountingStop(); /* the user program faults end here */
   if(!STREQ(zvm_state, OK_STATE)) FinalDump(gnap);
 
   SystemManifestDtor(gnap); /* finalize channels */
   AccountingDtor(gnap); /* get accounting */
   ProxyReport(gnap); /* show report */
+
+  /*
+   * the rest only releases the memory and the descriptors. _exit() does
+   * it faster, most of all the user space unmapping. the debug build
+   * releases all to keep the leaks checkers useful
+   */
+#ifdef DEBUG
   ChannelsDtor(gnap); /* free channels */
   NaClAppDtor(gnap); /* free user space and globals */
   NaClFreeDispatchThunk(gnap); /* free thunk */
   ZLogDtor(); /* close syslog */
   ManifestDtor(); /* free manifest */
+#endif
 }
 
 void SetExitState(const char *state)
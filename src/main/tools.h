@@ -27,6 +27,8 @@
 #include <fcntl.h>
 #include <glib.h>
 #include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include "src/main/nacl_base.h"
 #include "src/main/nacl_exit.h"
@@ -46,6 +48,9 @@
 #define ROUNDUP_64K(a) ROUNDDOWN_64K((a) + NACL_MAP_PAGESIZE - 1LLU)
 #define ROUNDDOWN_4K(a) ((a) & ~(NACL_PAGESIZE - 1LLU))
 #define ROUNDUP_4K(a) ROUNDDOWN_4K((a) + NACL_PAGESIZE - 1LLU)
+#define HUGE_PAGE_SIZE 0x200000LLU /* x86_64 transparent huge page */
+#define ROUNDDOWN_2M(a) ((a) & ~(HUGE_PAGE_SIZE - 1LLU))
+#define ROUNDUP_2M(a) ROUNDDOWN_2M((a) + HUGE_PAGE_SIZE - 1LLU)
 
 /* safe atoi(). NULL can be used. return 0 for NULL */
 static INLINE int64_t safe_atoi(const char *str)
@@ -69,4 +74,22 @@ static INLINE int64_t GetFileSize(const char *name)
   return fstat(handle, &fs), close(handle) ? -1 : fs.st_size;
 }
 
+/*
+ * create the thread pool of "threads" workers (0 - cpus number). the
+ * workers block all signals, zerovm signals belong to the main thread
+ */
+static INLINE GThreadPool *ThreadPoolCtor(GFunc func, int threads)
+{
+  GThreadPool *pool;
+  sigset_t all, old;
+
+  if(threads == 0) threads = MAX(1, sysconf(_SC_NPROCESSORS_ONLN));
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  pool = g_thread_pool_new(func, NULL, threads, TRUE, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  ZLOGFAIL(pool == NULL, EFAULT, "cannot create thread pool");
+  return pool;
+}
+
 #endif /* TOOLS_H_ */
@@ -0,0 +1,655 @@
+/*
+ * zerovm name server daemon. resolves network channels of many jobs
+ * at the same time (see doc/name_server.txt). single threaded, event
+ * driven: datagrams are received and sent in batches
+ *
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <glib.h>
+#include "src/channels/ns_protocol.h"
+
+#define NS_BATCH 256 /* datagrams received / sent per syscall */
+#define NS_SOCKET_BUFFER 0x1000000 /* 16mb */
+#define NS_SEND_WAIT 100 /* milliseconds to wait for the socket buffer space */
+#define NS_JOB_TTL 300 /* seconds to keep the job after the last request */
+#define NS_USAGE "usage: nameserver [-p port] [-n nodes] [-t ttl] [-v]\n"\
+    " -p udp port to listen (default 0 - any)\n"\
+    " -n nodes number of the jobs which did not specify it (default 1)\n"\
+    " -t seconds to keep the job after the last request (default 300)\n"\
+    " -v verbose\n"
+
+
+/* the node registration */
+struct Node
+{
+  uint32_t id;
+  struct sockaddr_in address; /* where the reply goes */
+  uint32_t binds;
+  uint32_t connects;
+  uint32_t fragments; /* request fragments number */
+  uint32_t received; /* request fragments received */
+  uint8_t *got; /* received fragments map */
+  struct ChannelNSRecord *records; /* binds + connects, network order */
+  char *reply; /* reply datagrams (NS_DATAGRAM_SIZE each) */
+  uint32_t *reply_sizes;
+};
+
+/* the last work queue answer of the node */
+struct Grant
+{
+  uint32_t sequence;
+  char reply[sizeof(struct NSHeader) + sizeof(struct NSWork)];
+};
+
+/* the work queue of the job. splits are given in the order */
+struct WorkQueue
+{
+  uint32_t next; /* the next split index */
+  uint32_t splits;
+  GHashTable *grants; /* node id -> struct Grant */
+};
+
+/* the job. all nodes are resolved at once */
+struct Job
+{
+  uint32_t id;
+  uint32_t nodes; /* expected nodes number */
+  uint32_t complete; /* nodes with all fragments received */
+  int resolved;
+  time_t touched; /* the last request time */
+  GHashTable *members; /* node id -> struct Node */
+  GHashTable *queues; /* queue id -> struct WorkQueue. NULL if none */
+};
+
+static GHashTable *jobs; /* job id -> struct Job */
+static uint32_t default_nodes = 1;
+static int ttl = NS_JOB_TTL;
+static int verbose = 0;
+static int sock = -1;
+
+/* the reply queue. flushed after each received batch */
+static struct mmsghdr queue[NS_BATCH];
+static struct iovec queue_iov[NS_BATCH];
+static int queued = 0;
+
+/* statistics */
+static uint64_t registrations = 0;
+static uint64_t resolutions = 0;
+static uint64_t splits = 0;
+
+/* log the message if verbose */
+static void Log(const char *fmt, ...)
+{
+  va_list ap;
+
+  if(!verbose) return;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+/* if the condition is true log the message with errno and exit */
+static void FailIf(int cond, const char *fmt, ...)
+{
+  va_list ap;
+
+  if(!cond) return;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fprintf(stderr, ": %s\n", strerror(errno));
+  exit(1);
+}
+
+/* return the fragments number needed to send given records number */
+static uint32_t Fragments(uint32_t records)
+{
+  return records == 0 ? 1 : (records - 1) / NS_FRAGMENT_RECORDS + 1;
+}
+
+static void NodeDtor(gpointer data)
+{
+  struct Node *node = data;
+
+  g_free(node->got);
+  g_free(node->records);
+  g_free(node->reply);
+  g_free(node->reply_sizes);
+  g_free(node);
+}
+
+static void WorkQueueDtor(gpointer data)
+{
+  struct WorkQueue *queue = data;
+
+  g_hash_table_destroy(queue->grants);
+  g_free(queue);
+}
+
+static void JobDtor(gpointer data)
+{
+  struct Job *job = data;
+
+  g_hash_table_destroy(job->members);
+  if(job->queues != NULL) g_hash_table_destroy(job->queues);
+  g_free(job);
+}
+
+/* send all queued datagrams */
+static void Flush()
+{
+  int sent = 0;
+
+  while(sent < queued)
+  {
+    int code = sendmmsg(sock, queue + sent, queued - sent, 0);
+    if(code < 0)
+    {
+      struct pollfd pfd;
+
+      if(errno == EINTR) continue;
+
+      /* the socket buffer is full. lost replies will be re-requested */
+      pfd.fd = sock;
+      pfd.events = POLLOUT;
+      if(errno == EAGAIN && poll(&pfd, 1, NS_SEND_WAIT) > 0) continue;
+      Log("cannot send replies: %s\n", strerror(errno));
+      break;
+    }
+    sent += code;
+  }
+  queued = 0;
+}
+
+/*
+ * queue the datagram to send. the buffer must live until Flush(), so the
+ * queue is flushed before any job or node is removed
+ */
+static void Queue(struct sockaddr_in *address, char *buffer, uint32_t size)
+{
+  if(queued == NS_BATCH) Flush();
+
+  queue_iov[queued].iov_base = buffer;
+  queue_iov[queued].iov_len = size;
+  memset(&queue[queued], 0, sizeof queue[queued]);
+  queue[queued].msg_hdr.msg_name = address;
+  queue[queued].msg_hdr.msg_namelen = sizeof *address;
+  queue[queued].msg_hdr.msg_iov = &queue_iov[queued];
+  queue[queued].msg_hdr.msg_iovlen = 1;
+  ++queued;
+}
+
+/* queue all reply fragments of the resolved node */
+static void SendReply(struct Node *node)
+{
+  uint32_t i;
+
+  for(i = 0; i < node->fragments; ++i)
+    Queue(&node->address, node->reply + i * NS_DATAGRAM_SIZE, node->reply_sizes[i]);
+}
+
+/* make the key for the (binder, connector) pair */
+static uint64_t Key(uint32_t binder, uint32_t connector)
+{
+  return (uint64_t)binder << 32 | connector;
+}
+
+/*
+ * hash of the pair key. g_int64_hash() folds the halves with xor, that
+ * gives few distinct values for the neighbour nodes (typical topologies)
+ */
+static guint KeyHash(gconstpointer key)
+{
+  uint64_t h = *(const uint64_t*)key * 0x9e3779b97f4a7c15ULL;
+  return (guint)(h >> 32);
+}
+
+/*
+ * build the reply datagrams of the node: the request records with the
+ * local flag of the co-located peers, the "connect" ones also resolved
+ */
+static void MakeReply(struct Job *job, struct Node *node, GHashTable *ports)
+{
+  uint32_t fragments = node->fragments;
+  uint32_t total = node->binds + node->connects;
+  uint32_t i;
+
+  node->reply = g_malloc0(fragments * NS_DATAGRAM_SIZE);
+  node->reply_sizes = g_malloc0(fragments * sizeof *node->reply_sizes);
+
+  for(i = 0; i < fragments; ++i)
+  {
+    char *datagram = node->reply + i * NS_DATAGRAM_SIZE;
+    struct NSHeader *header = (void*)datagram;
+    struct ChannelNSRecord *records = (void*)(datagram + sizeof *header);
+    uint32_t first = i * NS_FRAGMENT_RECORDS;
+    uint32_t count = MIN(total - first, NS_FRAGMENT_RECORDS);
+    uint32_t j;
+
+    header->magic = htonl(NS_MAGIC);
+    header->version = NS_VERSION;
+    header->type = NS_REPLY;
+    header->fragment = htons(i);
+    header->fragments = htons(fragments);
+    header->job = htonl(job->id);
+    header->nodes = htonl(job->nodes);
+    header->node = htonl(node->id);
+    header->binds = htonl(node->binds);
+    header->connects = htonl(node->connects);
+
+    for(j = 0; j < count; ++j)
+    {
+      struct ChannelNSRecord *record = &records[j];
+      const struct ChannelNSRecord *request = &node->records[first + j];
+      uint32_t peer_id = ntohl(request->id);
+      struct Node *peer = g_hash_table_lookup(job->members, GUINT_TO_POINTER(peer_id));
+      uint64_t key = Key(peer_id, node->id);
+      guint port;
+
+      /* "bind" record: tell the binder its peer is co-located */
+      *record = *request;
+      if(first + j < node->binds)
+      {
+        record->flags = peer != NULL && peer->address.sin_addr.s_addr
+            == node->address.sin_addr.s_addr ? request->flags & NS_LOCAL_FLAG : 0;
+        continue;
+      }
+
+      port = GPOINTER_TO_UINT(g_hash_table_lookup(ports, &key));
+      if(peer == NULL || port == 0)
+      {
+        Log("job %u: node %u has no peer %u\n", job->id, node->id, peer_id);
+        continue;
+      }
+      record->ip = peer->address.sin_addr.s_addr;
+      record->port = htons(port & 0xffff);
+      record->flags = peer->address.sin_addr.s_addr
+          == node->address.sin_addr.s_addr ? port >> 16 & NS_LOCAL_FLAG : 0;
+    }
+    node->reply_sizes[i] = sizeof *header + count * PARCEL_REC_SIZE;
+  }
+}
+
+/* resolve all nodes of the job and send the replies in a batch */
+static void Resolve(struct Job *job)
+{
+  GHashTable *ports = g_hash_table_new_full(KeyHash, g_int64_equal, g_free, NULL);
+  GHashTableIter i;
+  gpointer value;
+
+  /* index "bind" ports (the flags in the high half) by (binder, connector) */
+  g_hash_table_iter_init(&i, job->members);
+  while(g_hash_table_iter_next(&i, NULL, &value))
+  {
+    struct Node *node = value;
+    uint32_t j;
+
+    for(j = 0; j < node->binds; ++j)
+    {
+      uint64_t *key = g_malloc(sizeof *key);
+      *key = Key(node->id, ntohl(node->records[j].id));
+      g_hash_table_replace(ports, key, GUINT_TO_POINTER(ntohs(node->records[j].port)
+          | node->records[j].flags << 16));
+    }
+  }
+
+  g_hash_table_iter_init(&i, job->members);
+  while(g_hash_table_iter_next(&i, NULL, &value))
+  {
+    MakeReply(job, value, ports);
+    SendReply(value);
+  }
+
+  g_hash_table_destroy(ports);
+  job->resolved = 1;
+  ++resolutions;
+  Log("job %u resolved (%u nodes)\n", job->id, job->nodes);
+}
+
+/* return not 0 if the addresses are the same (ip and port) */
+static int SameAddress(const struct sockaddr_in *a, const struct sockaddr_in *b)
+{
+  return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+/* find or create the job of the request */
+static struct Job *GetJob(const struct NSHeader *header)
+{
+  uint32_t job_id = ntohl(header->job);
+  struct Job *job;
+
+  job = g_hash_table_lookup(jobs, GUINT_TO_POINTER(job_id));
+  if(job == NULL)
+  {
+    job = g_malloc0(sizeof *job);
+    job->id = job_id;
+    job->nodes = ntohl(header->nodes) ? ntohl(header->nodes) : default_nodes;
+    job->members = g_hash_table_new_full(g_direct_hash,
+        g_direct_equal, NULL, NodeDtor);
+    g_hash_table_insert(jobs, GUINT_TO_POINTER(job_id), job);
+  }
+  job->touched = time(NULL);
+  return job;
+}
+
+/*
+ * process one work queue request. the new request (greater sequence)
+ * takes the next split, the repeated one gets the stored answer
+ */
+static void Work(char *datagram, int size, struct sockaddr_in *address)
+{
+  struct NSHeader *header = (void*)datagram;
+  struct NSWork *work = (void*)(datagram + sizeof *header);
+  struct WorkQueue *queue;
+  struct Grant *grant;
+  struct Job *job;
+  uint32_t node_id, queue_id, sequence;
+
+  if(size != (int)(sizeof *header + sizeof *work)) return;
+
+  job = GetJob(header);
+  node_id = ntohl(header->node);
+  queue_id = ntohl(work->queue);
+  sequence = ntohl(work->sequence);
+
+  /* find or create the queue */
+  if(job->queues == NULL)
+    job->queues = g_hash_table_new_full(g_direct_hash,
+        g_direct_equal, NULL, WorkQueueDtor);
+  queue = g_hash_table_lookup(job->queues, GUINT_TO_POINTER(queue_id));
+  if(queue == NULL)
+  {
+    queue = g_malloc0(sizeof *queue);
+    queue->splits = ntohl(work->splits);
+    queue->grants = g_hash_table_new_full(g_direct_hash,
+        g_direct_equal, NULL, g_free);
+    g_hash_table_insert(job->queues, GUINT_TO_POINTER(queue_id), queue);
+  }
+  if(queue->splits != ntohl(work->splits))
+  {
+    Log("job %u: node %u has %u splits in queue %u instead of %u\n", job->id,
+        node_id, ntohl(work->splits), queue_id, queue->splits);
+    return;
+  }
+
+  /* find or create the node answer */
+  grant = g_hash_table_lookup(queue->grants, GUINT_TO_POINTER(node_id));
+  if(grant == NULL)
+  {
+    grant = g_malloc0(sizeof *grant);
+    g_hash_table_insert(queue->grants, GUINT_TO_POINTER(node_id), grant);
+  }
+
+  /* the outdated request is dropped, the new one takes the split */
+  if(sequence < grant->sequence) return;
+  if(sequence > grant->sequence)
+  {
+    struct NSWork *answer = (void*)(grant->reply + sizeof *header);
+
+    memcpy(grant->reply, datagram, sizeof grant->reply);
+    header = (void*)grant->reply;
+    header->type = NS_WORK_REPLY;
+    answer->split = htonl(queue->next < queue->splits ? queue->next++ : NS_WORK_DONE);
+    grant->sequence = sequence;
+    ++splits;
+  }
+
+  Queue(address, grant->reply, sizeof grant->reply);
+}
+
+/* process one request datagram */
+static void Request(char *datagram, int size, struct sockaddr_in *address)
+{
+  struct NSHeader *header = (void*)datagram;
+  struct Job *job;
+  struct Node *node;
+  uint32_t node_id, binds, connects, fragment, first, count;
+
+  /* drop invalid datagrams */
+  if(size < (int)sizeof *header) return;
+  if(ntohl(header->magic) != NS_MAGIC || header->version != NS_VERSION) return;
+  if(header->type == NS_WORK)
+  {
+    Work(datagram, size, address);
+    return;
+  }
+  if(header->type != NS_REQUEST) return;
+
+  node_id = ntohl(header->node);
+  binds = ntohl(header->binds);
+  connects = ntohl(header->connects);
+  fragment = ntohs(header->fragment);
+  if(binds > NS_MAX_RECORDS || connects > NS_MAX_RECORDS - binds) return;
+  if(ntohs(header->fragments) != Fragments(binds + connects)) return;
+  if(fragment >= Fragments(binds + connects)) return;
+  first = fragment * NS_FRAGMENT_RECORDS;
+  count = MIN(binds + connects - first, NS_FRAGMENT_RECORDS);
+  if(size != (int)(sizeof *header + count * PARCEL_REC_SIZE)) return;
+
+  job = GetJob(header);
+
+  /*
+   * the resolved job answers only the repeated requests of its nodes (the
+   * same source address). any other registration is the next run of the
+   * job id (always so for job 0, "not specified"): the new generation of
+   * the job replaces the old one with its replies and work queues
+   */
+  if(job->resolved)
+  {
+    node = g_hash_table_lookup(job->members, GUINT_TO_POINTER(node_id));
+    if(node == NULL || !SameAddress(&node->address, address)
+        || node->binds != binds || node->connects != connects)
+    {
+      Log("job %u: node %u starts the new generation\n", job->id, node_id);
+      Flush();
+      g_hash_table_remove(jobs, GUINT_TO_POINTER(job->id));
+      job = GetJob(header);
+    }
+  }
+
+  /* find or create the node. registration with other counts replaces it */
+  node = g_hash_table_lookup(job->members, GUINT_TO_POINTER(node_id));
+  if(node != NULL && (node->binds != binds || node->connects != connects))
+  {
+    if(node->received == node->fragments) --job->complete;
+    Flush();
+    g_hash_table_remove(job->members, GUINT_TO_POINTER(node_id));
+    node = NULL;
+  }
+  if(node == NULL)
+  {
+    node = g_malloc0(sizeof *node);
+    node->id = node_id;
+    node->binds = binds;
+    node->connects = connects;
+    node->fragments = Fragments(binds + connects);
+    node->got = g_malloc0(node->fragments);
+    node->records = g_malloc0((binds + connects + 1) * PARCEL_REC_SIZE);
+    g_hash_table_insert(job->members, GUINT_TO_POINTER(node_id), node);
+  }
+  node->address = *address;
+
+  /* the resolved node repeated the request: repeat the reply */
+  if(job->resolved)
+  {
+    SendReply(node);
+    return;
+  }
+
+  /* store the fragment (repeated fragment overwrites the previous one) */
+  memcpy(node->records + first, datagram + sizeof *header, count * PARCEL_REC_SIZE);
+  if(node->got[fragment]) return;
+  node->got[fragment] = 1;
+  if(++node->received < node->fragments) return;
+
+  ++registrations;
+  if(++job->complete == job->nodes) Resolve(job);
+}
+
+/* receive and process all available datagrams */
+static void Receive()
+{
+  static char buffers[NS_BATCH][NS_DATAGRAM_SIZE];
+  static struct sockaddr_in sources[NS_BATCH];
+  struct mmsghdr msgs[NS_BATCH];
+  struct iovec iov[NS_BATCH];
+  int count;
+  int i;
+
+  do
+  {
+    for(i = 0; i < NS_BATCH; ++i)
+    {
+      iov[i].iov_base = buffers[i];
+      iov[i].iov_len = NS_DATAGRAM_SIZE;
+      memset(&msgs[i], 0, sizeof msgs[i]);
+      msgs[i].msg_hdr.msg_name = &sources[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof sources[i];
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    count = recvmmsg(sock, msgs, NS_BATCH, MSG_DONTWAIT, NULL);
+    if(count < 0) break;
+
+    for(i = 0; i < count; ++i)
+      Request(buffers[i], msgs[i].msg_len, &sources[i]);
+
+    /* replies refer to the node buffers and addresses. send them now */
+    Flush();
+  } while(count == NS_BATCH);
+}
+
+/* remove the jobs without requests during ttl */
+static gboolean Expired(gpointer key, gpointer value, gpointer now)
+{
+  struct Job *job = value;
+  return job->touched + ttl < *(time_t*)now;
+}
+
+static void Expire()
+{
+  time_t now = time(NULL);
+  int count = g_hash_table_foreach_remove(jobs, Expired, &now);
+
+  if(count > 0)
+    Log("%d jobs expired, %u jobs active, %lu registrations, %lu resolutions, "
+        "%lu splits\n", count, g_hash_table_size(jobs), registrations,
+        resolutions, splits);
+}
+
+int main(int argc, char **argv)
+{
+  struct sockaddr_in address;
+  struct itimerspec period;
+  struct epoll_event ev;
+  socklen_t size = sizeof address;
+  int buffer = NS_SOCKET_BUFFER;
+  int port = 0;
+  int poller;
+  int timer;
+  int opt;
+
+  while((opt = getopt(argc, argv, "p:n:t:v")) != -1)
+  {
+    switch(opt)
+    {
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 'n':
+        default_nodes = atoi(optarg);
+        break;
+      case 't':
+        ttl = atoi(optarg);
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      default:
+        fprintf(stderr, NS_USAGE);
+        return 1;
+    }
+  }
+
+  /* open the server socket */
+  sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+  FailIf(sock < 0, "cannot create socket");
+  /* the registration burst must not overflow the buffers (privileged run can exceed rmem_max) */
+  if(setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &buffer, sizeof buffer) != 0)
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof buffer);
+  if(setsockopt(sock, SOL_SOCKET, SO_SNDBUFFORCE, &buffer, sizeof buffer) != 0)
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof buffer);
+  memset(&address, 0, sizeof address);
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  FailIf(bind(sock, (void*)&address, sizeof address) != 0, "cannot bind %d", port);
+  FailIf(getsockname(sock, (void*)&address, &size) != 0, "cannot get port");
+  printf("%u\n", ntohs(address.sin_port));
+  fflush(stdout);
+
+  /* the timer to expire old jobs */
+  timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  FailIf(timer < 0, "cannot create timer");
+  memset(&period, 0, sizeof period);
+  period.it_value.tv_sec = period.it_interval.tv_sec = MAX(1, ttl / 2);
+  FailIf(timerfd_settime(timer, 0, &period, NULL) != 0, "cannot set timer");
+
+  poller = epoll_create1(0);
+  FailIf(poller < 0, "cannot create epoll");
+  ev.events = EPOLLIN;
+  ev.data.fd = sock;
+  FailIf(epoll_ctl(poller, EPOLL_CTL_ADD, sock, &ev) != 0, "cannot watch socket");
+  ev.data.fd = timer;
+  FailIf(epoll_ctl(poller, EPOLL_CTL_ADD, timer, &ev) != 0, "cannot watch timer");
+
+  jobs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, JobDtor);
+
+  /* the event loop */
+  for(;;)
+  {
+    struct epoll_event events[2];
+    int count = epoll_wait(poller, events, 2, -1);
+    int i;
+
+    for(i = 0; i < count; ++i)
+    {
+      if(events[i].data.fd == sock)
+        Receive();
+      else
+      {
+        uint64_t ticks;
+        if(read(timer, &ticks, sizeof ticks) > 0) Expire();
+      }
+    }
+  }
+
+  return 0;
+}
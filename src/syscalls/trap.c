@@ -25,6 +25,9 @@
 #include "src/syscalls/trap.h"
 #include "src/main/manifest_setup.h"
 #include "src/channels/prefetch.h"
+#include "src/channels/ring.h"
+#include "src/channels/collective.h"
+#include "src/channels/record.h"
 #include "src/main/nacl_globals.h"
 #include "src/platform/sel_memory.h"
 
@@ -66,16 +69,14 @@ static int ChannelIOMask(struct ChannelDesc *channel)
   return rw;
 }
 
-/* updates channel tag */
-static void UpdateChannelTag(struct ChannelDesc *channel,
-    const char *buffer, int32_t size)
+/* updates channel tag (given tag context can be NULL) */
+static void UpdateChannelTag(void *tag, const char *buffer, int32_t size)
 {
-  assert(channel != NULL);
   assert(buffer != NULL);
 
   /* update etag and log information */
-  if(channel->tag != NULL && size > 0)
-    TagUpdate(channel->tag, buffer, size);
+  if(tag != NULL && size > 0)
+    TagUpdate(tag, buffer, size);
 }
 
 /*
@@ -147,8 +148,8 @@ static int32_t ZVMReadHandle(struct NaClApp *nap,
   if(size < 0) return -EFAULT;
   if(offset < 0) return -EINVAL;
 
-  /* check for eof */
-  if(channel->eof) return 0;
+  /* check for eof (the record framed channel can have the records read ahead) */
+  if(channel->eof && !RecordPending(channel)) return 0;
 
   /* check limits */
   if(channel->counters[GetsLimit] >= channel->limits[GetsLimit])
@@ -162,33 +163,18 @@ static int32_t ZVMReadHandle(struct NaClApp *nap,
   if(size > tail) size = tail;
   if(size < 1) return -EDQUOT;
 
-  /* read data and update position */
-  switch(channel->source)
-  {
-    case ChannelRegular:
-      retcode = pread(channel->handle, sys_buffer, (size_t)size, (off_t)offset);
-      if(retcode == -1) retcode = -errno;
-      break;
-    case ChannelCharacter:
-    case ChannelFIFO:
-     retcode = fread(sys_buffer, 1, (size_t)size, (FILE*)channel->socket);
-      if(retcode == -1) retcode = -errno;
-      break;
-    case ChannelTCP:
-      retcode = FetchMessage(channel, sys_buffer, size);
-      if(retcode == -1) retcode = -EIO;
-      break;
-    default: /* design error */
-      ZLOGFAIL(1, EFAULT, "invalid channel source");
-      break;
-  }
+  /* read data (whole records from the record framed channel) */
+  if(channel->record != NULL)
+    retcode = RecordFetch(channel, sys_buffer, size);
+  else
+    retcode = ChannelRead(channel, sys_buffer, size, offset);
 
   /* update the channel counter, size, position and tag */
   ++channel->counters[GetsLimit];
   if(retcode > 0)
   {
     channel->counters[GetSizeLimit] += retcode;
-    UpdateChannelTag(channel, (const char*)sys_buffer, retcode);
+    UpdateChannelTag(channel->tag, (const char*)sys_buffer, retcode);
 
     /*
      * current get cursor. must be updated if channel have seq get
@@ -260,6 +246,10 @@ static int32_t ZVMWriteHandle(struct NaClApp *nap,
   if(size > tail) size = tail;
   if(size < 1) return -EDQUOT;
 
+  /* the record framed channel takes the whole records only */
+  if(channel->record != NULL && RecordCheck(channel, sys_buffer, size) != 0)
+    return -EINVAL;
+
   /* write data and update position */
   switch(channel->source)
   {
@@ -274,7 +264,11 @@ static int32_t ZVMWriteHandle(struct NaClApp *nap,
       break;
     case ChannelTCP:
       retcode = SendMessage(channel, sys_buffer, size);
-      if(retcode == -1) retcode = -EIO;
+      if(retcode == -1) retcode = channel->cancelled ? -EPIPE : -EIO;
+      break;
+    case ChannelIPC:
+      retcode = RingSend(channel, sys_buffer, size);
+      if(retcode == -1) retcode = channel->cancelled ? -EPIPE : -EIO;
       break;
     default: /* design error */
       ZLOGFAIL(1, EFAULT, "invalid channel source");
@@ -286,7 +280,9 @@ static int32_t ZVMWriteHandle(struct NaClApp *nap,
   if(retcode > 0)
   {
     channel->counters[PutSizeLimit] += retcode;
-    UpdateChannelTag(channel, (const char*)sys_buffer, retcode);
+    /* duplex channel keeps the written data in the separate tag */
+    UpdateChannelTag(channel->duplex ? channel->wtag : channel->tag,
+        (const char*)sys_buffer, retcode);
 
     channel->putpos = offset + retcode;
     channel->size = (channel->type == SGetRPut) || (channel->type == RGetRPut) ?
@@ -342,8 +338,65 @@ static int32_t ZVMUnjailHandle(struct NaClApp *nap, uintptr_t addr, int32_t size
 
   return 0;
 }
+
+/*
+ * drop the pages of the heap range, the next touch gets the zero pages.
+ * the range becomes read / write (the jailed code is discarded too).
+ * return 0 if successful
+ */
+static int32_t ZVMDiscardHandle(struct NaClApp *nap, uintptr_t addr, int32_t size)
+{
+  JAIL_CHECK;
+
+  /* the whole range must be the heap pages */
+  if(size != ROUNDDOWN_64K(size)) return -EINVAL;
+  if(sysaddr + size > nap->mem_map[HeapIdx].end) return -EINVAL;
+
+  result = NaCl_mprotect((void*)sysaddr, size, PROT_READ | PROT_WRITE);
+  if(result != 0) return -EACCES;
+  result = NaCl_madvise((void*)sysaddr, size, MADV_DONTNEED);
+  if(result != 0) return result;
+
+  return 0;
+}
 #undef JAIL_CHECK
 
+/*
+ * check the collective call buffer (it is the source and the destination
+ * both) and return its system address or NULL if the buffer is invalid
+ */
+static char *CollectiveBuffer(struct NaClApp *nap, uintptr_t buffer, int64_t size)
+{
+  if(size < 0 || size > INT32_MAX) return NULL;
+  if(CheckRAMAccess(nap, buffer, size, PROT_WRITE) == -1) return NULL;
+  return (char*)NaClUserToSys(nap, buffer);
+}
+
+/* broadcast "size" bytes of "root" buffer to all group nodes */
+static int32_t ZVMBroadcastHandle(struct NaClApp *nap,
+    uintptr_t buffer, int32_t size, uint32_t root)
+{
+  char *sys_buffer = CollectiveBuffer(nap, buffer, size);
+
+  if(sys_buffer == NULL) return -EINVAL;
+  return CollectiveBroadcast(sys_buffer, size, root);
+}
+
+/*
+ * reduce the buffers of all group nodes to "root" node buffer. if
+ * "root" is negative the result goes to all nodes (allreduce)
+ */
+static int32_t ZVMReduceHandle(struct NaClApp *nap, uintptr_t buffer,
+    int32_t count, int32_t type, int32_t op, int64_t root)
+{
+  char *sys_buffer = CollectiveBuffer(nap, buffer,
+      (int64_t)count * CollectiveTypeSize(type));
+
+  if(sys_buffer == NULL) return -EINVAL;
+  return root < 0 ? CollectiveAllreduce(sys_buffer, count, type, op)
+      : CollectiveReduce(sys_buffer, count, type, op, root);
+}
+
 /* this function debug only. return function name by id */
 static const char *FunctionNameById(int id)
 {
@@ -354,6 +407,12 @@ static const char *FunctionNameById(int id)
     case TrapJail: return "TrapJail";
     case TrapUnjail: return "TrapUnjail";
     case TrapExit: return "TrapExit";
+    case TrapBarrier: return "TrapBarrier";
+    case TrapBroadcast: return "TrapBroadcast";
+    case TrapReduce: return "TrapReduce";
+    case TrapAllreduce: return "TrapAllreduce";
+    case TrapHeap: return "TrapHeap";
+    case TrapDiscard: return "TrapDiscard";
   }
   return "not supported";
 }
@@ -392,6 +451,27 @@ int32_t TrapHandler(struct NaClApp *nap, uint32_t args)
     case TrapUnjail:
       retcode = ZVMUnjailHandle(nap, (uint32_t)sys_args[2], (int32_t)sys_args[3]);
       break;
+    case TrapBarrier:
+      retcode = CollectiveBarrier();
+      break;
+    case TrapBroadcast:
+      retcode = ZVMBroadcastHandle(nap, (uint32_t)sys_args[2],
+          (int32_t)sys_args[3], (uint32_t)sys_args[4]);
+      break;
+    case TrapReduce:
+      retcode = ZVMReduceHandle(nap, (uint32_t)sys_args[2], (int32_t)sys_args[3],
+          (int32_t)sys_args[4], (int32_t)sys_args[5], (uint32_t)sys_args[6]);
+      break;
+    case TrapAllreduce:
+      retcode = ZVMReduceHandle(nap, (uint32_t)sys_args[2], (int32_t)sys_args[3],
+          (int32_t)sys_args[4], (int32_t)sys_args[5], -1);
+      break;
+    case TrapHeap:
+      retcode = GrowUserHeap(nap, (uint32_t)sys_args[2]);
+      break;
+    case TrapDiscard:
+      retcode = ZVMDiscardHandle(nap, (uint32_t)sys_args[2], (int32_t)sys_args[3]);
+      break;
     default:
       retcode = -EPERM;
       ZLOG(LOG_ERROR, "function %ld is not supported", *sys_args);
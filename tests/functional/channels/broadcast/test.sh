@@ -0,0 +1,13 @@
+#!/bin/sh
+# one publisher broadcasts 16mb to 3 subscribers through the single channel
+
+printf "\033[01;38mbroadcast channel\033[00m test has"
+
+make clean all>/dev/null
+result=$(for n in 2 3 4; do cmp output$n.data input.data 2>&1; done)
+if [ "" != "$result" ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+fi
@@ -0,0 +1,54 @@
+/*
+ * upstream cancellation test. the producer writes up to 1gb to stdout,
+ * the consumer takes 1mb from stdin and exits. the producer must get
+ * the broken pipe instead of writing the rest. the producer puts
+ * "cancelled" or "completed" to the result channel
+ */
+#include <errno.h>
+#include "include/zvmlib.h"
+
+#define RESULT "/dev/result"
+#define CHUNK_SIZE 0x10000
+#define PRODUCE_SIZE 0x40000000LL
+#define CONSUME_SIZE 0x100000
+
+static int producer()
+{
+  static char buffer[CHUNK_SIZE];
+  int64_t size;
+
+  for(size = 0; size < PRODUCE_SIZE; size += CHUNK_SIZE)
+  {
+    int count = WRITE(STDOUT, buffer, CHUNK_SIZE);
+    if(count < 0)
+    {
+      FPRINTF(STDERR, "write error %d after %lld bytes\n", count, size);
+      FPRINTF(RESULT, "cancelled\n");
+      return count == -EPIPE ? 0 : 1;
+    }
+  }
+
+  FPRINTF(RESULT, "completed\n");
+  return 1;
+}
+
+static int consumer()
+{
+  static char buffer[CHUNK_SIZE];
+  int size;
+
+  for(size = 0; size < CONSUME_SIZE;)
+  {
+    int count = READ(STDIN, buffer, CHUNK_SIZE);
+    if(count <= 0) return 1;
+    size += count;
+  }
+
+  FPRINTF(STDERR, "%d bytes taken, exiting\n", size);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  return STRCMP(argv[0], "producer") == 0 ? producer() : consumer();
+}
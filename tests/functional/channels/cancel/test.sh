@@ -0,0 +1,13 @@
+#!/bin/sh
+# the consumer takes 1mb of 1gb stream and exits. the producer must
+# be stopped with the broken pipe (ring and native tcp channels)
+
+printf "\033[01;38mupstream cancellation\033[00m test has"
+
+make clean all>/dev/null
+if [ "$(cat ipc.data native.data 2>/dev/null)" != "$(printf 'cancelled\ncancelled')" ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+fi
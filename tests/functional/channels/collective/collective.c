@@ -0,0 +1,55 @@
+/*
+ * collective operations test. every node of the group checks barrier,
+ * broadcast from each node, reduce to each node and allreduce. the node
+ * position is given via command line. the node puts "passed" or
+ * "failed" to the result channel
+ */
+#include "include/zvmlib.h"
+
+#define RESULT "/dev/result"
+#define NODES 4
+#define COUNT 100000
+
+static int32_t ints[COUNT];
+static double doubles[COUNT];
+
+static int test(int rank)
+{
+  int root;
+  int i;
+
+  if(zvm_barrier() != 0) return 1;
+
+  for(root = 0; root < NODES; ++root)
+  {
+    /* broadcast */
+    for(i = 0; i < COUNT; ++i) ints[i] = rank == root ? i * root : -1;
+    if(zvm_bcast(ints, sizeof ints, root) != 0) return 2;
+    for(i = 0; i < COUNT; ++i)
+      if(ints[i] != i * root) return 3;
+
+    /* reduce: the other than root buffers must stay untouched */
+    for(i = 0; i < COUNT; ++i) ints[i] = rank + i;
+    if(zvm_reduce(ints, COUNT, ReduceInt32, ReduceSum, root) != 0) return 4;
+    for(i = 0; i < COUNT; ++i)
+      if(ints[i] != (rank == root ? NODES * i + NODES * (NODES - 1) / 2 : rank + i))
+        return 5;
+  }
+
+  /* allreduce: all nodes must get the same bits */
+  for(i = 0; i < COUNT; ++i) doubles[i] = 0.1 * (rank + 1) + i;
+  if(zvm_allreduce(doubles, COUNT, ReduceDouble, ReduceMax) != 0) return 6;
+  for(i = 0; i < COUNT; ++i)
+    if(doubles[i] != 0.1 * NODES + i) return 7;
+
+  return zvm_barrier() != 0 ? 8 : 0;
+}
+
+int main(int argc, char **argv)
+{
+  int code = test(ATOI(argv[0]));
+
+  FPRINTF(STDERR, "test returned %d\n", code);
+  FPRINTF(RESULT, "%s\n", code == 0 ? "passed" : "failed");
+  return code;
+}
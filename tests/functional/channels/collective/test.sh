@@ -0,0 +1,13 @@
+#!/bin/sh
+# 4 nodes run barrier, broadcast, reduce and allreduce collective operations
+
+printf "\033[01;38mcollective operations\033[00m test has"
+
+make clean all>/dev/null
+if [ "$(cat result1.data result2.data result3.data result4.data 2>/dev/null)" \
+    != "$(printf 'passed\npassed\npassed\npassed')" ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+fi
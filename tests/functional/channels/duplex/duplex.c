@@ -0,0 +1,53 @@
+/*
+ * duplex network channel test. the client sends the numbers to the
+ * server through /dev/peer and takes the answers (number + 1) from
+ * the same channel. the server answers until eof. the client puts
+ * "passed" or "failed" to the result channel
+ */
+#include "include/zvmlib.h"
+
+#define PEER "/dev/peer"
+#define RESULT "/dev/result"
+#define EXCHANGES 10000
+
+static int client()
+{
+  int i;
+
+  for(i = 0; i < EXCHANGES; ++i)
+  {
+    int answer = 0;
+
+    if(WRITE(PEER, (char*)&i, sizeof i) != sizeof i
+        || READ(PEER, (char*)&answer, sizeof answer) != sizeof answer
+        || answer != i + 1)
+    {
+      FPRINTF(STDERR, "exchange %d failed, answer %d\n", i, answer);
+      FPRINTF(RESULT, "failed\n");
+      return 1;
+    }
+  }
+
+  FPRINTF(RESULT, "passed\n");
+  return 0;
+}
+
+static int server()
+{
+  int request;
+  int count;
+
+  for(count = 0; READ(PEER, (char*)&request, sizeof request) == sizeof request; ++count)
+  {
+    ++request;
+    if(WRITE(PEER, (char*)&request, sizeof request) != sizeof request) return 1;
+  }
+
+  FPRINTF(STDERR, "%d requests answered\n", count);
+  return count != EXCHANGES;
+}
+
+int main(int argc, char **argv)
+{
+  return STRCMP(argv[0], "client") == 0 ? client() : server();
+}
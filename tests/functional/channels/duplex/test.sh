@@ -0,0 +1,12 @@
+#!/bin/sh
+# two nodes exchange request/response pairs over one duplex native channel
+
+printf "\033[01;38mduplex channel\033[00m test has"
+
+make clean all>/dev/null
+if [ "$(cat result.data 2>/dev/null)" != "passed" ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+fi
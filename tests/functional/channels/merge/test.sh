@@ -0,0 +1,14 @@
+#!/bin/sh
+# 3 sorted inputs of 100-byte records are read as one ordered stream. the
+# 2nd run cuts the 3rd input with its getsize limit in the middle of a record
+
+printf "\033[01;38mmerge channel\033[00m test has"
+
+make clean all>/dev/null
+result=$(cmp output.data expected.data 2>&1; cmp limit.data limit_expected.data 2>&1)
+if [ "" != "$result" ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+fi
@@ -1,51 +1,130 @@
-import socket
-import sys
-import struct
-import ctypes
-
-peers = int(sys.argv[1])
-port = 0
-if len(sys.argv) > 2 and sys.argv[2]:
-    port = int(sys.argv[2])
-s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
-s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
-s.bind(('', port))
-print s.getsockname()[1]
-bind_map = {}
-conn_map = {}
-peer_map = {}
-while 1:
-    try:
-        message, address = s.recvfrom(65535)
-        print [str(message), len(message)]
-        offset = 0
-        alias = struct.unpack_from('!I', message, offset)[0]
-        print '%08x = %s:%d' % (alias, address[0], address[1])
-        offset += 4
-        count = struct.unpack_from('!I', message, offset)[0]
-        offset += 4
-        for i in range(count):
-            h, _junk, port = struct.unpack_from('!IIH', message, offset)[0:3]
-            bind_map.setdefault(alias, {})[h] = port
-            print '%08x:%d <- %08x' % (alias, port, h)
-            offset += 10
-        conn_map[alias] = ctypes.create_string_buffer(message[offset:])
-        peer_map.setdefault(alias, {})[0] = address[0]
-        peer_map.setdefault(alias, {})[1] = address[1]
-
-        if len(peer_map) == peers:
-            for src in peer_map.iterkeys():
-                reply = conn_map[src]
-                offset = 0
-                count = struct.unpack_from('!I', reply, offset)[0]
-                offset += 4
-                for i in range(count):
-                    h = struct.unpack_from('!I', reply, offset)[0]
-                    port = bind_map[h][src]
-                    struct.pack_into('!4sH', reply, offset + 4, socket.inet_pton(socket.AF_INET, peer_map[src][0]), port)
-                    offset += 10
-                s.sendto(reply, (peer_map[src][0], peer_map[src][1]))
-                print ['sending to: ', peer_map[src][0], peer_map[src][1]]
-    except (KeyboardInterrupt, SystemExit):
-        exit(1)
-
+"""
+zerovm name server stand-in (protocol v2, see doc/name_server.txt)
+usage: ns_server.py peers [port]
+peers is the nodes number of the jobs which did not specify it
+"""
+from __future__ import print_function
+import socket
+import sys
+import struct
+
+HEADER = struct.Struct('!IBBHHHIIIII')
+RECORD = struct.Struct('!IIHB')
+MAGIC = 0x5a564e53
+VERSION = 2
+REQUEST = 1
+REPLY = 2
+DATAGRAM_SIZE = 1400
+FRAGMENT_RECORDS = (DATAGRAM_SIZE - HEADER.size) // RECORD.size
+LOCAL = 1
+
+
+def fragments(records):
+    return max(1, (records + FRAGMENT_RECORDS - 1) // FRAGMENT_RECORDS)
+
+
+class Node(object):
+    def __init__(self, binds, connects):
+        self.binds = binds
+        self.connects = connects
+        self.parts = {}
+        self.address = None
+        self.reply = None
+
+    def complete(self):
+        return len(self.parts) == fragments(self.binds + self.connects)
+
+    def records(self):
+        result = []
+        for i in sorted(self.parts):
+            result += self.parts[i]
+        return result
+
+
+class Job(object):
+    def __init__(self, nodes):
+        self.nodes = nodes
+        self.members = {}
+
+    def resolve(self, job):
+        # bind port of every (binder, connector) pair
+        ports = {}
+        for node_id, node in self.members.items():
+            for h, _ip, port, flags in node.records()[:node.binds]:
+                ports[(node_id, h)] = (port, flags)
+
+        for node_id, node in self.members.items():
+            records = []
+            # bind records: the local flag if the connector is co-located
+            for h, ip, port, flags in node.records()[:node.binds]:
+                peer = self.members[h].address[0]
+                local = flags & LOCAL if peer == node.address[0] else 0
+                records.append(RECORD.pack(h, ip, port, local))
+            for h, _ip, _port, _flags in node.records()[node.binds:]:
+                peer = self.members[h].address[0]
+                port, flags = ports[(h, node_id)]
+                local = flags & LOCAL if peer == node.address[0] else 0
+                records.append(RECORD.pack(h, struct.unpack('!I',
+                    socket.inet_aton(peer))[0], port, local))
+
+            node.reply = []
+            total = fragments(node.binds + node.connects)
+            for i in range(total):
+                header = HEADER.pack(MAGIC, VERSION, REPLY, i, total, 0,
+                    job, self.nodes, node_id, node.binds, node.connects)
+                part = records[i * FRAGMENT_RECORDS:(i + 1) * FRAGMENT_RECORDS]
+                node.reply.append(header + b''.join(part))
+
+
+def main():
+    peers = int(sys.argv[1])
+    port = 0
+    if len(sys.argv) > 2 and sys.argv[2]:
+        port = int(sys.argv[2])
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 22)
+    s.bind(('', port))
+    print(s.getsockname()[1])
+    sys.stdout.flush()
+    jobs = {}
+
+    while 1:
+        message, address = s.recvfrom(65535)
+        if len(message) < HEADER.size:
+            continue
+        (magic, version, kind, fragment, total, _reserved, job_id, nodes,
+            node_id, binds, connects) = HEADER.unpack_from(message)
+        if magic != MAGIC or version != VERSION or kind != REQUEST:
+            continue
+
+        job = jobs.setdefault(job_id, Job(nodes or peers))
+        node = job.members.get(node_id)
+        if node is None or (node.binds, node.connects) != (binds, connects):
+            node = job.members[node_id] = Node(binds, connects)
+        node.address = address
+
+        # the resolved node repeated the request: repeat the reply
+        if node.reply is not None:
+            for datagram in node.reply:
+                s.sendto(datagram, address)
+            continue
+
+        count = (len(message) - HEADER.size) // RECORD.size
+        node.parts[fragment] = [RECORD.unpack_from(message,
+            HEADER.size + i * RECORD.size) for i in range(count)]
+
+        # all nodes registered: send batched replies
+        complete = [n for n in job.members.values() if n.complete()]
+        if len(complete) == job.nodes:
+            job.resolve(job_id)
+            for n in job.members.values():
+                for datagram in n.reply:
+                    s.sendto(datagram, n.address)
+
+
+if __name__ == '__main__':
+    try:
+        main()
+    except (KeyboardInterrupt, SystemExit):
+        exit(1)
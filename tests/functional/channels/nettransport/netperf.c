@@ -0,0 +1,55 @@
+/*
+ * network transports comparison. two nodes exchange the messages
+ * of the given size given number of rounds: the 1st node ("ping")
+ * sends the message and waits for the reply, the 2nd one ("pong")
+ * sends back every received message. small messages and many rounds
+ * measure the latency, big messages - the throughput. the time is
+ * measured outside (see test.sh). returns 0 if there were no errors
+ *
+ * nvram: "ping|pong rounds size"
+ */
+#include "include/zvmlib.h"
+
+#define MAX_SIZE 0x100000
+#define BREAKIF(cond, ...) if(cond) {FPRINTF(STDERR, __VA_ARGS__); break;}
+
+static char buffer[MAX_SIZE];
+
+int main(int argc, char **argv)
+{
+  int ping;
+  int rounds;
+  int size;
+  int i;
+
+  if(argc < 3) return 1;
+  ping = argv[0][1] == 'i';
+  rounds = atoi(argv[1]);
+  size = atoi(argv[2]);
+  if(size <= 0 || size > MAX_SIZE) return 1;
+
+  for(i = 0; i < rounds; ++i)
+  {
+    int count;
+
+    if(ping)
+    {
+      buffer[0] = (char)i;
+      count = WRITE(STDOUT, buffer, size);
+      BREAKIF(count != size, "write error %d\n", count);
+    }
+
+    count = READ(STDIN, buffer, size);
+    BREAKIF(count != size, "read error %d\n", count);
+    BREAKIF(buffer[0] != (char)i, "message %d is lost\n", i);
+
+    if(!ping)
+    {
+      count = WRITE(STDOUT, buffer, size);
+      BREAKIF(count != size, "write error %d\n", count);
+    }
+  }
+
+  FPRINTF(STDERR, "%d rounds of %d bytes done\n", i, size);
+  return i == rounds ? 0 : 1;
+}
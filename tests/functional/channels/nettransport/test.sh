@@ -0,0 +1,39 @@
+#!/bin/sh
+# compare zmq and native transports on the local two-node setup
+# latency: 10000 rounds of 64 bytes, throughput: 256 rounds of 1mb.
+# only the zerovm runs are timed: the nexe is built and the name
+# server is started beforehand
+
+run()
+{
+  make manifests TRANSPORT=$1 ROUNDS=$2 SIZE=$3 >/dev/null
+  python $ZEROVM_ROOT/tests/functional/channels/netcopy/ns_server.py 2 54321 >/dev/null &
+  ns=$!
+  sleep 1
+
+  start=$(date +%s%N)
+  $ZEROVM_ROOT/zerovm netperf2.manifest > pong.log&
+  pong=$!
+  $ZEROVM_ROOT/zerovm netperf1.manifest > ping.log
+  wait $pong
+  stop=$(date +%s%N)
+  kill $ns
+
+  # the 2nd line of the report is the user return code
+  result=$(sed -n 2p ping.log | grep -o "[0-9]*$")$(sed -n 2p pong.log | grep -o "[0-9]*$")
+  if [ "$result" != "00" ]; then
+    echo " \033[01;31mfailed\033[00m"
+    exit 1
+  fi
+  echo "$(( ($stop - $start) / 1000000 ))"
+}
+
+make clean all >/dev/null
+for transport in zmq native; do
+  latency=$(run $transport 10000 64) || { echo "$latency"; exit 1; }
+  throughput=$(run $transport 256 1048576) || { echo "$throughput"; exit 1; }
+  printf "\033[01;38m%s\033[00m transport: %s ms latency run," $transport $latency
+  echo " $throughput ms throughput run"
+done
+echo "net transport test has \033[01;32mpassed\033[00m"
+make clean >/dev/null
@@ -0,0 +1,256 @@
+/*
+ * name server benchmark. simulates the given number of nodes of one
+ * job registering at the same time (protocol v2, see doc/name_server.txt)
+ * and reports the registration throughput (nodes resolved per second,
+ * from the first request sent to the last reply received) and the time
+ * to resolve
+ * usage: nsbench nodes degree server_port [sockets]
+ * each node connects to "degree" next nodes and is connected by "degree"
+ * previous ones. the nodes share "sockets" udp sockets (default 16),
+ * the replies are told apart by the host identifier in the header
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "src/channels/ns_protocol.h"
+
+#define SOCKETS 16
+#define TIMEOUT_MIN 100 /* milliseconds, as in zerovm */
+#define TIMEOUT_MAX 3200
+#define BIND_PORT(binder, connector) (1024 + ((binder) * 7919 + (connector)) % 60000)
+
+struct SimulatedNode
+{
+  uint32_t id;
+  int sock;
+  uint32_t fragments; /* request fragments */
+  uint32_t replies; /* reply fragments */
+  uint32_t replied; /* reply fragments received */
+  uint8_t *got;
+  double deadline; /* when to repeat the request */
+  int timeout;
+  double elapsed; /* time to resolve, ms */
+};
+
+static uint32_t nodes;
+static uint32_t degree;
+static struct sockaddr_in server;
+static int retries;
+static int errors;
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static uint32_t Fragments(uint32_t records)
+{
+  return records == 0 ? 1 : (records + NS_FRAGMENT_RECORDS - 1) / NS_FRAGMENT_RECORDS;
+}
+
+/* the peer "i" steps away (1-based ids) */
+static uint32_t Peer(uint32_t node, int64_t i)
+{
+  return (uint32_t)(((int64_t)node - 1 + i + (int64_t)nodes * degree) % nodes) + 1;
+}
+
+/* send the whole request of the node */
+static void SendRequest(struct SimulatedNode *node)
+{
+  char datagram[NS_DATAGRAM_SIZE];
+  struct NSHeader *header = (void*)datagram;
+  struct ChannelNSRecord *records = (void*)(datagram + sizeof *header);
+  uint32_t fragment;
+
+  for(fragment = 0; fragment < node->fragments; ++fragment)
+  {
+    uint32_t first = fragment * NS_FRAGMENT_RECORDS;
+    uint32_t count = 0;
+    uint32_t i;
+
+    memset(datagram, 0, sizeof datagram);
+    header->magic = htonl(NS_MAGIC);
+    header->version = NS_VERSION;
+    header->type = NS_REQUEST;
+    header->fragment = htons(fragment);
+    header->fragments = htons(node->fragments);
+    header->job = htonl(getpid());
+    header->nodes = htonl(nodes);
+    header->node = htonl(node->id);
+    header->binds = htonl(degree);
+    header->connects = htonl(degree);
+
+    /* binds are connected by the previous nodes, connects go to the next */
+    for(i = first; i < 2 * degree && count < NS_FRAGMENT_RECORDS; ++i, ++count)
+    {
+      uint32_t peer = i < degree ? Peer(node->id, -(int64_t)i - 1)
+          : Peer(node->id, i - degree + 1);
+      records[count].id = htonl(peer);
+      records[count].port = i < degree ? htons(BIND_PORT(node->id, peer)) : 0;
+    }
+
+    while(sendto(node->sock, datagram, sizeof *header + count * PARCEL_REC_SIZE,
+        0, (void*)&server, sizeof server) < 0)
+    {
+      struct pollfd p;
+      if(errno != EAGAIN && errno != ENOBUFS) { perror("sendto"); exit(1); }
+      p.fd = node->sock;
+      p.events = POLLOUT;
+      poll(&p, 1, 10);
+    }
+  }
+
+  node->deadline = Now() + node->timeout;
+}
+
+/* take the reply fragment and check it */
+static void Reply(struct SimulatedNode *all, char *datagram, int size, double begin)
+{
+  struct NSHeader *header = (void*)datagram;
+  struct ChannelNSRecord *records = (void*)(datagram + sizeof *header);
+  struct SimulatedNode *node;
+  uint32_t fragment;
+  uint32_t i;
+
+  if(size < (int)sizeof *header || ntohl(header->magic) != NS_MAGIC
+      || header->type != NS_REPLY) return;
+  i = ntohl(header->node);
+  if(i < 1 || i > nodes) return;
+  node = &all[i - 1];
+  fragment = ntohs(header->fragment);
+  if(fragment >= node->replies || node->got[fragment]) return;
+
+  /* the reply repeats the "bind" records and resolves the "connect" ones */
+  node->got[fragment] = 1;
+  for(i = 0; i < (size - sizeof *header) / PARCEL_REC_SIZE; ++i)
+  {
+    uint32_t index = fragment * NS_FRAGMENT_RECORDS + i;
+    uint32_t expected;
+
+    if(index < degree)
+    {
+      expected = Peer(node->id, -(int64_t)index - 1);
+      if(ntohl(records[i].id) != expected && errors++ < 10)
+        fprintf(stderr, "node %u got invalid record for %u\n", node->id, expected);
+      continue;
+    }
+
+    expected = Peer(node->id, index - degree + 1);
+    if(ntohl(records[i].id) != expected || records[i].ip == 0
+        || ntohs(records[i].port) != BIND_PORT(expected, node->id))
+    {
+      if(errors++ < 10)
+        fprintf(stderr, "node %u got invalid record for %u\n", node->id, expected);
+    }
+  }
+
+  if(++node->replied == node->replies)
+    node->elapsed = Now() - begin;
+}
+
+static int Compare(const void *a, const void *b)
+{
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+  struct SimulatedNode *all;
+  struct pollfd *polls;
+  double *times;
+  double begin;
+  uint32_t pending;
+  int sockets = SOCKETS;
+  uint32_t i;
+
+  if(argc < 4)
+  {
+    fprintf(stderr, "usage: nsbench nodes degree server_port [sockets]\n");
+    return 2;
+  }
+  nodes = atoi(argv[1]);
+  degree = atoi(argv[2]);
+  if(argc > 4) sockets = atoi(argv[4]);
+  assert(nodes > 0 && sockets > 0 && degree < nodes);
+
+  memset(&server, 0, sizeof server);
+  server.sin_family = AF_INET;
+  server.sin_port = htons(atoi(argv[3]));
+  server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  polls = calloc(sockets, sizeof *polls);
+  for(i = 0; i < (uint32_t)sockets; ++i)
+  {
+    int buffer = 0x1000000;
+    polls[i].fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    polls[i].events = POLLIN;
+    setsockopt(polls[i].fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof buffer);
+  }
+
+  all = calloc(nodes, sizeof *all);
+  times = calloc(nodes, sizeof *times);
+  for(i = 0; i < nodes; ++i)
+  {
+    all[i].id = i + 1;
+    all[i].sock = polls[i % sockets].fd;
+    all[i].fragments = Fragments(2 * degree);
+    all[i].replies = Fragments(2 * degree);
+    all[i].got = calloc(all[i].replies, 1);
+    all[i].timeout = TIMEOUT_MIN;
+  }
+
+  /* all nodes start at once */
+  begin = Now();
+  for(i = 0; i < nodes; ++i)
+    SendRequest(&all[i]);
+
+  for(pending = nodes; pending > 0;)
+  {
+    char datagram[NS_DATAGRAM_SIZE];
+    double now;
+    int j;
+
+    poll(polls, sockets, 1);
+    for(j = 0; j < sockets; ++j)
+    {
+      int size;
+      while((size = recv(polls[j].fd, datagram, sizeof datagram, 0)) > 0)
+        Reply(all, datagram, size, begin);
+    }
+
+    /* repeat the requests of the nodes which did not get the reply in time */
+    now = Now();
+    for(pending = 0, i = 0; i < nodes; ++i)
+    {
+      if(all[i].replied == all[i].replies) continue;
+      ++pending;
+      if(now < all[i].deadline) continue;
+      ++retries;
+      all[i].timeout = all[i].timeout * 2 > TIMEOUT_MAX ? TIMEOUT_MAX : all[i].timeout * 2;
+      SendRequest(&all[i]);
+    }
+  }
+
+  for(i = 0; i < nodes; ++i)
+    times[i] = all[i].elapsed;
+  qsort(times, nodes, sizeof *times, Compare);
+
+  printf("%u nodes, %u channels per node: %.0f registrations/s, "
+      "resolve p50 %.1f ms, p99 %.1f ms, max %.1f ms, %d retries\n",
+      nodes, 2 * degree, nodes / (times[nodes - 1] > 0 ? times[nodes - 1] : 1e-3) * 1e3,
+      times[nodes / 2], times[(uint32_t)(nodes * 0.99)], times[nodes - 1], retries);
+  return errors != 0;
+}
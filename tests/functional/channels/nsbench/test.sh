@@ -0,0 +1,24 @@
+#!/bin/sh
+# name server daemon benchmark: jobs of 10..10000 simulated nodes register
+# at once. prints registrations resolved per second and resolution time p50/p99
+
+NS_PORT=54323
+gcc -O2 -I$ZEROVM_ROOT -o nsbench $(dirname $0)/nsbench.c || exit 1
+$ZEROVM_ROOT/nameserver -p $NS_PORT >/dev/null&
+sleep 1
+
+failed=0
+# nodes, channels per node / 2
+for args in "10 4" "100 4" "1000 4" "10000 4" "1000 100"; do
+  set -- $args
+  ./nsbench $1 $2 $NS_PORT || failed=1
+done
+kill $!
+rm -f nsbench
+
+printf "\033[01;38mname server benchmark\033[00m test has"
+if [ $failed != 0 ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+fi
@@ -0,0 +1,136 @@
+"""
+name service load test. brings up given number of simulated nodes
+which resolve their channels via the name server (protocol v2) at
+the same time and reports the resolution time percentiles
+usage: nsload.py nodes degree server_port [loss]
+each node connects to "degree" next nodes (and is connected by
+"degree" previous ones). "loss" is the share of the requests
+datagrams dropped on purpose to exercise retries
+"""
+from __future__ import print_function
+import random
+import socket
+import struct
+import sys
+import threading
+import time
+
+HEADER = struct.Struct('!IBBHHHIIIII')
+RECORD = struct.Struct('!IIHB')
+MAGIC = 0x5a564e53
+VERSION = 2
+REQUEST = 1
+REPLY = 2
+DATAGRAM_SIZE = 1400
+FRAGMENT_RECORDS = (DATAGRAM_SIZE - HEADER.size) // RECORD.size
+TIMEOUT_MIN = 0.1
+TIMEOUT_MAX = 3.2
+
+
+def fragments(records):
+    return max(1, (records + FRAGMENT_RECORDS - 1) // FRAGMENT_RECORDS)
+
+
+def bind_port(binder, connector):
+    return 1024 + (binder * 7919 + connector) % 60000
+
+
+class SimulatedNode(threading.Thread):
+    def __init__(self, job, nodes, node, degree, server, loss, start):
+        threading.Thread.__init__(self)
+        self.job, self.nodes, self.node = job, nodes, node
+        self.server, self.loss, self.start_event = server, loss, start
+        # node ids are 1-based
+        self.connects = [(node - 1 + i) % nodes + 1 for i in range(1, degree + 1)]
+        self.binds = [(node - 1 - i) % nodes + 1 for i in range(1, degree + 1)]
+        self.elapsed = None
+        self.retries = 0
+        self.error = None
+
+    def request(self):
+        records = [RECORD.pack(h, 0, bind_port(self.node, h), 0) for h in self.binds]
+        records += [RECORD.pack(h, 0, 0, 0) for h in self.connects]
+        total = fragments(len(records))
+        result = []
+        for i in range(total):
+            header = HEADER.pack(MAGIC, VERSION, REQUEST, i, total, 0, self.job,
+                self.nodes, self.node, len(self.binds), len(self.connects))
+            part = records[i * FRAGMENT_RECORDS:(i + 1) * FRAGMENT_RECORDS]
+            result.append(header + b''.join(part))
+        return result
+
+    def run(self):
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sock.connect(self.server)
+        datagrams = self.request()
+        total = fragments(len(self.connects))
+        reply = {}
+        timeout = TIMEOUT_MIN
+        self.start_event.wait()
+        begin = time.time()
+
+        while len(reply) < total:
+            for datagram in datagrams:
+                if random.random() >= self.loss:
+                    sock.send(datagram)
+            deadline = time.time() + timeout
+            while len(reply) < total and time.time() < deadline:
+                sock.settimeout(max(0.001, deadline - time.time()))
+                try:
+                    message = sock.recv(65535)
+                except socket.timeout:
+                    break
+                fields = HEADER.unpack_from(message)
+                if fields[2] != REPLY or fields[8] != self.node:
+                    continue
+                count = (len(message) - HEADER.size) // RECORD.size
+                reply[fields[3]] = [RECORD.unpack_from(message,
+                    HEADER.size + i * RECORD.size) for i in range(count)]
+            if len(reply) < total:
+                self.retries += 1
+                timeout = min(timeout * 2, TIMEOUT_MAX)
+
+        self.elapsed = time.time() - begin
+        sock.close()
+
+        # check the answer
+        records = []
+        for i in sorted(reply):
+            records += reply[i]
+        for (h, ip, port, _flags), expected in zip(records, self.connects):
+            if h != expected or port != bind_port(h, self.node) or ip == 0:
+                self.error = 'node %d got invalid record for %d' % (self.node, h)
+
+
+def percentile(values, share):
+    return values[min(len(values) - 1, int(len(values) * share))]
+
+
+def main():
+    nodes, degree, port = [int(a) for a in sys.argv[1:4]]
+    loss = float(sys.argv[4]) if len(sys.argv) > 4 else 0.0
+    job = random.randint(1, 0x7fffffff)
+    start = threading.Event()
+    threads = [SimulatedNode(job, nodes, i, degree, ('127.0.0.1', port), loss, start)
+        for i in range(1, nodes + 1)]
+    for t in threads:
+        t.start()
+    begin = time.time()
+    start.set()
+    for t in threads:
+        t.join()
+    total = time.time() - begin
+
+    errors = [t.error for t in threads if t.error]
+    times = sorted(t.elapsed * 1000 for t in threads)
+    print('%d nodes, %d channels per node, %.0f%% loss: p50 %.1f ms, '
+        'p99 %.1f ms, max %.1f ms, total %.1f ms, %d retries' % (nodes,
+        2 * degree, loss * 100, percentile(times, 0.5), percentile(times, 0.99),
+        times[-1], total * 1000, sum(t.retries for t in threads)))
+    for e in errors[:10]:
+        print(e)
+    return 1 if errors else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,22 @@
+#!/bin/sh
+# name service load test: hundreds of simulated nodes resolve channels
+# at once via the stand-in name server. prints resolution time p50/p99
+
+NS_PORT=54322
+python $ZEROVM_ROOT/tests/functional/channels/netcopy/ns_server.py 1 $NS_PORT >/dev/null&
+sleep 1
+
+failed=0
+# nodes, channels per node / 2, requests loss
+for args in "500 4 0" "500 200 0" "300 4 0.05"; do
+  set -- $args
+  python $(dirname $0)/nsload.py $1 $2 $NS_PORT $3 || failed=1
+done
+kill $!
+
+printf "\033[01;38mname service load\033[00m test has"
+if [ $failed != 0 ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+fi
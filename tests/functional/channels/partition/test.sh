@@ -0,0 +1,14 @@
+#!/bin/sh
+# one mapper partitions 200000 100-byte records by the 8-byte key to 3 reducers
+
+printf "\033[01;38mpartition channel\033[00m test has"
+
+make clean all>/dev/null
+lost=$(cat output2.data output3.data output4.data | sort | cmp - input.data 2>&1)
+shared=$(for n in 2 3 4; do cut -c1-8 output$n.data | sort -u; done | sort | uniq -d)
+if [ "" != "$lost$shared" ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+fi
@@ -0,0 +1,44 @@
+/*
+ * work queue channel test. takes the splits from the queue channel until
+ * it is over, reads each split from its input and hashes it (the cost
+ * is proportional to the split size). each split is reported to the
+ * standard output as "channel offset length hash"
+ */
+#include "include/zvmlib.h"
+
+#define QUEUE "/dev/queue"
+#define BUFFER_SIZE 0x100000
+#define ROUNDS 8 /* the work per byte */
+
+int main(int argc, char **argv)
+{
+  static char buffer[BUFFER_SIZE];
+  struct ZVMSplit split;
+  int splits = 0;
+
+  for(;;)
+  {
+    uint32_t hash = 0x811c9dc5;
+    int code = READ(QUEUE, &split, sizeof split);
+    int i, j;
+
+    if(code == 0) break;
+    if(code != sizeof split || split.length > BUFFER_SIZE
+        || zvm_pread(split.channel, buffer, split.length, split.offset) != split.length)
+    {
+      FPRINTF(STDERR, "split %d failed with %d\n", splits, code);
+      return 1;
+    }
+
+    for(j = 0; j < ROUNDS; ++j)
+      for(i = 0; i < split.length; ++i)
+        hash = (hash ^ (uint8_t)buffer[i]) * 0x01000193;
+
+    FPRINTF(STDOUT, "%d %d %d %u\n", split.channel,
+        (int)split.offset, (int)split.length, hash);
+    ++splits;
+  }
+
+  FPRINTF(STDERR, "%d splits processed\n", splits);
+  return 0;
+}
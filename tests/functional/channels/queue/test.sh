@@ -0,0 +1,19 @@
+#!/bin/sh
+# 3 nodes process the skewed inputs (48mb, 4mb, 4mb) split by 1mb. the static
+# assignment (one input per node) must be slower than the shared work queue
+
+printf "\033[01;38mqueue channel\033[00m test has"
+
+make clean all>/dev/null
+size=$(cat input1.data input2.data input3.data | wc -c)
+taken=$(cat output_dynamic_*.data | awk '{s += $3} END {print s}')
+repeated=$(cat output_dynamic_*.data | cut -d' ' -f1-2 | sort | uniq -d)
+cat output_dynamic_*.data | sort > dynamic.log
+same=$(cat output_static_*.data | sort | cmp - dynamic.log 2>&1)
+if [ "$size" != "$taken" -o "" != "$repeated$same" ] \
+    || [ $(cat dynamic.time) -ge $(cat static.time) ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m (static $(cat static.time) ms, dynamic $(cat dynamic.time) ms)"
+        make clean>/dev/null
+fi
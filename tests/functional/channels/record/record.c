@@ -0,0 +1,59 @@
+/*
+ * record framed channel test. reads the lines of the standard input
+ * with the random buffer sizes, each read must end with the complete
+ * line. the buffer grows when the line does not fit it. the lines are written to the standard output, the
+ * incomplete line write must fail. puts "passed" or "failed" to the
+ * result channel
+ */
+#include "include/zvmlib.h"
+
+#define RESULT "/dev/result"
+#define BUFFER_SIZE 0x100000
+#define ERR_MSGSIZE -90 /* linux EMSGSIZE */
+#define ERR_INVAL -22 /* linux EINVAL */
+
+int main(int argc, char **argv)
+{
+  static char buffer[BUFFER_SIZE];
+  int plan = 1;
+  int reads = 0;
+  int grows = 0;
+  int code;
+
+  /* the incomplete record cannot be written */
+  code = WRITE(STDOUT, "no new line", 11);
+  if(code != ERR_INVAL)
+  {
+    FPRINTF(STDERR, "incomplete record written with %d\n", code);
+    FPRINTF(RESULT, "failed\n");
+    return 1;
+  }
+
+  for(;;)
+  {
+    int count = READ(STDIN, buffer, plan);
+
+    /* the line does not fit the buffer */
+    if(count == ERR_MSGSIZE && plan < BUFFER_SIZE)
+    {
+      plan = MIN(2 * plan, BUFFER_SIZE);
+      ++grows;
+      continue;
+    }
+    if(count == 0) break;
+    if(count < 0 || count > plan || buffer[count - 1] != '\n'
+        || WRITE(STDOUT, buffer, count) != count)
+    {
+      FPRINTF(STDERR, "read %d of %d failed with %d\n", reads, plan, count);
+      FPRINTF(RESULT, "failed\n");
+      return 1;
+    }
+
+    ++reads;
+    plan = RAND() % 4096 + 1;
+  }
+
+  FPRINTF(STDERR, "%d reads, %d buffer grows\n", reads, grows);
+  FPRINTF(RESULT, "passed\n");
+  return 0;
+}
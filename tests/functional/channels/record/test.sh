@@ -0,0 +1,13 @@
+#!/bin/sh
+# lines of 1..20000 bytes are read from the record framed channel by whole lines
+
+printf "\033[01;38mrecord channel\033[00m test has"
+
+make clean all>/dev/null
+result=$(cat result.log 2>&1; cmp output.data input.data 2>&1)
+if [ "passed" != "$result" ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+fi
@@ -0,0 +1,26 @@
+/*
+ * etag benchmark. writes 256mb of the pattern to the standard output
+ * by 1mb writes, the time is measured outside
+ */
+#include "include/zvmlib.h"
+
+#define BUFFER_SIZE 0x100000
+#define TOTAL 256
+
+int main(int argc, char **argv)
+{
+  static char buffer[BUFFER_SIZE];
+  int i;
+
+  for(i = 0; i < BUFFER_SIZE; ++i)
+    buffer[i] = i * 7;
+
+  for(i = 0; i < TOTAL; ++i)
+    if(WRITE(STDOUT, buffer, BUFFER_SIZE) != BUFFER_SIZE)
+    {
+      FPRINTF(STDERR, "write %d failed\n", i);
+      return 1;
+    }
+
+  return 0;
+}
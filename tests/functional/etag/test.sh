@@ -0,0 +1,37 @@
+#!/bin/sh
+# etag engines benchmark: 256mb written to the etagged channel with each
+# engine. prints the hashing throughput, checks sha digests with coreutils.
+# the tree mode (sha256 of 1mb leaves) must give the same digest twice
+
+# run the manifest, return the milliseconds spent and the last etag
+run()
+{
+  start=$(date +%s%N)
+  digest=$($ZEROVM_ROOT/zerovm $1.manifest | awk 'NR == 3 {print $NF}')
+  elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+}
+
+make clean all>/dev/null
+run none
+base=$elapsed
+
+failed=0
+for engine in sha1 sha256 xxh64 tree; do
+  run $engine
+  hashing=$(( elapsed > base ? elapsed - base : 1 ))
+  echo "$engine: $digest, $(( 256 * 1000 / hashing )) mb/s"
+  case $engine in
+    sha1) [ "$digest" = "$(sha1sum output.data | cut -d' ' -f1)" ] || failed=1;;
+    sha256) [ "$digest" = "$(sha256sum output.data | cut -d' ' -f1)" ] || failed=1;;
+    xxh64) [ ${#digest} = 16 ] || failed=1;;
+    tree) tree=$digest; run tree; [ "$digest" = "$tree" ] || failed=1;;
+  esac
+done
+
+printf "\033[01;38metag benchmark\033[00m test has"
+if [ $failed != 0 ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+fi
@@ -0,0 +1,75 @@
+/*
+ * functional test of the heap traps. the manifest opens 1mb of the
+ * heap, the rest (up to the "Memory" limit) is given by zvm_heap. the
+ * heap range released by zvm_discard reads as zeroes
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+#define MB 0x100000
+
+/* touch the last heap byte */
+static int touch()
+{
+  char *end = (char*)MANIFEST->heap_ptr + MANIFEST->heap_size - 1;
+
+  *end = 1;
+  return *end == 1;
+}
+
+/* return not 0 if "size" bytes of "buffer" are equal to "c" */
+static int filled(const char *buffer, int size, char c)
+{
+  int i;
+
+  for(i = 0; i < size; ++i)
+    if(buffer[i] != c) return 0;
+  return 1;
+}
+
+int main()
+{
+  uint32_t initial = MANIFEST->heap_size;
+  char *p;
+  char stack;
+
+  /* the initial heap */
+  ZTEST(initial > 0 && initial <= MB + PAGESIZE);
+  ZTEST(touch());
+
+  /* the heap does not shrink */
+  ZTEST(zvm_heap(initial / 2) == 0);
+  ZTEST(MANIFEST->heap_size == initial);
+
+  /* grow the heap */
+  ZTEST(zvm_heap(8 * MB) == 0);
+  ZTEST(MANIFEST->heap_size >= 8 * MB);
+  ZTEST(MANIFEST->heap_size < 8 * MB + PAGESIZE);
+  ZTEST(touch());
+
+  /* the same size again */
+  ZTEST(zvm_heap(8 * MB) == 0);
+  ZTEST(MANIFEST->heap_size >= 8 * MB);
+
+  /* over the limit */
+  ZTEST(zvm_heap(64 * MB) < 0);
+  ZTEST(MANIFEST->heap_size < 8 * MB + PAGESIZE);
+
+  /* release 1mb of the heap */
+  p = (char*)(uintptr_t)ROUNDUP_64K((uintptr_t)MANIFEST->heap_ptr);
+  memset(p, 0xab, MB);
+  ZTEST(zvm_discard(p, MB) == 0);
+  ZTEST(filled(p, MB, 0));
+  memset(p, 0xcd, MB);
+  ZTEST(filled(p, MB, 0xcd));
+
+  /* invalid ranges */
+  ZTEST(zvm_discard(p + 1, PAGESIZE) < 0);
+  ZTEST(zvm_discard(p, PAGESIZE - 1) < 0);
+  ZTEST(zvm_discard(p, 64 * MB) < 0);
+  ZTEST(zvm_discard((char*)ROUNDDOWN_64K((uintptr_t)&stack), PAGESIZE) < 0);
+  ZTEST(filled(p, MB, 0xcd));
+
+  ZREPORT;
+  return 0;
+}
@@ -0,0 +1,50 @@
+#!/bin/sh
+# huge pages benchmark: sort and lz4 demos run with the small and with the
+# huge pages backed user memory. prints the time spent, the outputs must match
+
+# run the manifest in the demo directory, return the milliseconds spent
+run()
+{
+  start=$(date +%s%N)
+  (cd $1 && $ZEROVM_ROOT/zerovm -PQs $2 >/dev/null)
+  elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+}
+
+# make the huge pages copy of the manifest
+huge()
+{
+  sed 's#^\(Memory = [0-9]*, [0-9]*\)$#\1, 1#' $1/$2 > $1/huge.$2
+}
+
+SORT=$ZEROVM_ROOT/tests/functional/demo/sort
+LZ4=$ZEROVM_ROOT/tests/functional/demo/lz4
+failed=0
+
+# sort: the demo makefile generates the data and the manifests
+make -C $SORT clean all>/dev/null
+huge $SORT sort_uint_proper_with_args.manifest
+run $SORT sort_uint_proper_with_args.manifest
+small=$elapsed
+cp $SORT/sorted.data $SORT/small.data
+run $SORT huge.sort_uint_proper_with_args.manifest
+echo "sort: small pages $small ms, huge pages $elapsed ms"
+cmp -s $SORT/sorted.data $SORT/small.data || failed=1
+
+# lz4
+make -C $LZ4 clean all>/dev/null
+huge $LZ4 lz4demo.manifest
+run $LZ4 lz4demo.manifest
+small=$elapsed
+cp $LZ4/output.lz4 $LZ4/small.lz4
+run $LZ4 huge.lz4demo.manifest
+echo "lz4: small pages $small ms, huge pages $elapsed ms"
+cmp -s $LZ4/output.lz4 $LZ4/small.lz4 || failed=1
+
+printf "\033[01;38mhuge pages benchmark\033[00m test has"
+if [ $failed != 0 ]; then
+        echo " \033[01;31mfailed\033[00m"
+else
+        echo " \033[01;32mpassed\033[00m"
+        make -C $SORT clean>/dev/null
+        make -C $LZ4 clean>/dev/null
+fi